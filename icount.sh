@@ -0,0 +1,71 @@
+#!/bin/sh
+# Count instructions, branches, branch mispredictions and simulated cache misses
+# per byte set (or copied, with -C) for each implementation, by running it with
+# fixed inputs under valgrind's callgrind. Unlike wall clock benchmarks these
+# numbers are deterministic, so small changes to an implementation can be
+# compared on a noisy machine. Only the implementation itself is counted
+# (--toggle-collect); the harness around it is not.
+#
+# Usage: icount.sh [-C] [memset binary]
+#
+# -C counts the copy kernels instead; the alignment then applies to the
+# destination. Set SIZES, ALIGNS or BYTES (the total number of bytes set per
+# measurement) to override the defaults below.
+
+set -e
+
+COPIES=
+if [ "$1" = -C ]; then
+    COPIES=-C
+    shift
+fi
+MEMSET=${1:-./memset}
+SIZES=${SIZES:-"64 4096 1048576"}
+ALIGNS=${ALIGNS:-"0 1"}
+BYTES=${BYTES:-4194304}
+
+if ! command -v valgrind >/dev/null 2>&1; then
+    echo "valgrind not found" >&2
+    exit 1
+fi
+
+out=$(mktemp)
+trap 'rm -f "$out"' EXIT
+
+printf "%-30s %9s %5s %10s %10s %10s %10s %10s\n" kernel size align \
+    "instr/B" "branch/B" "mispred/B" "D1miss/B" "LLmiss/B"
+"$MEMSET" run $COPIES -l | while read -r kernel granularity; do
+    # The C library's functions are reached through IFUNCs, so their names
+    # vary.
+    case $kernel in
+        memset|memcpy|memmove) toggle="*$kernel*" ;;
+        *) toggle=$kernel ;;
+    esac
+    for size in $SIZES; do
+        for align in $ALIGNS; do
+            if [ $(( (size | align) % granularity )) -ne 0 ]; then
+                continue
+            fi
+            iterations=$(( BYTES / size ))
+            [ "$iterations" -gt 0 ] || iterations=1
+            valgrind -q --tool=callgrind --cache-sim=yes --branch-sim=yes \
+                --toggle-collect="$toggle" --callgrind-out-file="$out" \
+                "$MEMSET" run $COPIES -k "$kernel" -s "$size" -a "$align" \
+                -i "$iterations"
+            awk -v kernel="$kernel" -v size="$size" -v align="$align" \
+                -v bytes=$(( size * iterations )) '
+                /^events:/ { for (i = 2; i <= NF; ++i) event[i - 1] = $i }
+                /^(summary|totals):/ {
+                    for (i = 2; i <= NF; ++i) count[event[i - 1]] = $i
+                }
+                END {
+                    printf "%-30s %9d %5d %10.4f %10.4f %10.4f %10.4f %10.4f\n",
+                        kernel, size, align, count["Ir"] / bytes,
+                        (count["Bc"] + count["Bi"]) / bytes,
+                        (count["Bcm"] + count["Bim"]) / bytes,
+                        (count["D1mr"] + count["D1mw"]) / bytes,
+                        (count["DLmr"] + count["DLmw"]) / bytes
+                }' "$out"
+        done
+    done
+done
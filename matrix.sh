@@ -0,0 +1,88 @@
+#!/bin/sh
+# Build memset.c with each available compiler at several optimisation levels,
+# benchmark every build and tabulate per-kernel throughput side by side. The
+# rankings of the implementations change between compilers, mostly depending on
+# how much each one auto-vectorises the word-wise and Duff's device loops.
+#
+# Usage: matrix.sh [bench options...]
+#
+# Set COMPILERS or FLAGS to override the defaults below. Entries in FLAGS are
+# separated by commas, as they contain spaces. Builds and results go in
+# ./matrix.
+
+set -e
+
+COMPILERS=${COMPILERS:-"gcc clang"}
+FLAGS=${FLAGS:-"-O2,-O3,-O3 -march=native"}
+OUT=matrix
+
+if [ $# -eq 0 ]; then
+    set -- -n 11 -s 64,1K,4K,64K,1M -a 0,1
+fi
+
+mkdir -p "$OUT"
+configs=
+for cc in $COMPILERS; do
+    if ! command -v "$cc" >/dev/null 2>&1; then
+        echo "skipping $cc: not found" >&2
+        continue
+    fi
+    IFS=,
+    for flags in $FLAGS; do
+        unset IFS
+        name="$cc$(echo "$flags" | tr -d ' ' | sed 's/-march=/-/')"
+        echo "building and benchmarking $name" >&2
+        make -s -B memset CC="$cc" CFLAGS="$flags" >/dev/null
+        mv memset "$OUT/memset-$name"
+        "$OUT/memset-$name" bench "$@" -o "$OUT/$name" >"$OUT/$name.txt"
+        configs="$configs $name"
+    done
+    unset IFS
+done
+
+if [ -z "$configs" ]; then
+    echo "no compilers found" >&2
+    exit 1
+fi
+
+# Throughput in GB/s, one column per configuration.
+for c in $configs; do
+    echo "$OUT/$c.json"
+done | xargs awk '
+    FNR == 1 {
+        name = FILENAME
+        sub(/.*\//, "", name)
+        sub(/\.json$/, "", name)
+        configs[++n] = name
+    }
+    /"kernel"/ {
+        match($0, /"kernel": "[^"]*"/)
+        kernel = substr($0, RSTART + 11, RLENGTH - 12)
+        match($0, /"size": [0-9]+/)
+        size = substr($0, RSTART + 8, RLENGTH - 8)
+        match($0, /"align": [0-9]+/)
+        align = substr($0, RSTART + 9, RLENGTH - 9)
+        match($0, /"median": [0-9.e+-]+/)
+        median = substr($0, RSTART + 10, RLENGTH - 10)
+        key = sprintf("%-30s %9s %5s", kernel, size, align)
+        if (!(key in seen)) {
+            seen[key] = 1
+            keys[++rows] = key
+        }
+        gbps[key, name] = size / median / 1e9
+    }
+    END {
+        printf "%-30s %9s %5s", "kernel", "size", "align"
+        for (i = 1; i <= n; ++i)
+            printf " %14s", configs[i]
+        printf "\n"
+        for (r = 1; r <= rows; ++r) {
+            printf "%s", keys[r]
+            for (i = 1; i <= n; ++i)
+                if ((keys[r], configs[i]) in gbps)
+                    printf " %14.3f", gbps[keys[r], configs[i]]
+                else
+                    printf " %14s", "-"
+            printf "\n"
+        }
+    }'
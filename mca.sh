@@ -0,0 +1,94 @@
+#!/bin/sh
+# Predict how each implementation's loops would run on microarchitectures we
+# don't have to hand, using llvm-mca's static throughput model. We pull every
+# loop (a backward branch to a label earlier in the same function) out of each
+# *_memset, *_memcpy and *_memmove function in the compiler's assembly output
+# and report llvm-mca's predicted cycles per iteration and the most heavily used
+# resource for each.
+#
+# Usage: mca.sh memset.s
+#
+# Set MCPUS to override the CPU models below; models this llvm-mca does not know
+# are skipped. Set MCA to use a particular llvm-mca binary.
+
+set -e
+
+ASM=${1:-memset.s}
+MCA=${MCA:-llvm-mca}
+MCPUS=${MCPUS:-"skylake-avx512 icelake-server sapphirerapids znver2 znver3 znver4"}
+
+if ! command -v "$MCA" >/dev/null 2>&1; then
+    echo "$MCA not found" >&2
+    exit 1
+fi
+
+known=$("$MCA" -mcpu=help </dev/null 2>&1 | awk '{ print $1 }')
+cpus=
+for cpu in $MCPUS; do
+    if echo "$known" | grep -qx -- "$cpu"; then
+        cpus="$cpus $cpu"
+    else
+        echo "skipping $cpu: unknown to $MCA" >&2
+    fi
+done
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# Write each loop's instructions to $dir/<function>@<label>.s.
+awk -v dir="$dir" '
+    /^[A-Za-z_][A-Za-z0-9_]*:/ {
+        fn = substr($1, 1, index($1, ":") - 1)
+        n = 0
+        delete label
+        next
+    }
+    fn !~ /_(memset|memcpy|memmove)$/ { next }
+    /^\.L[A-Za-z0-9_]+:/ {
+        label[substr($1, 1, index($1, ":") - 1)] = n
+        next
+    }
+    /^[ \t]+[a-z]/ {
+        line[n++] = $0
+        if ($1 ~ /^j/ && ($2 in label)) {
+            out = dir "/" fn "@" $2 ".s"
+            for (i = label[$2]; i < n; ++i)
+                print line[i] > out
+            close(out)
+        }
+    }' "$ASM"
+
+printf "%-30s %-10s %6s %-16s %12s  %s\n" kernel loop insns cpu cycles/iter \
+    bottleneck
+for loop in "$dir"/*.s; do
+    [ -e "$loop" ] || continue
+    name=$(basename "$loop" .s)
+    kernel=${name%@*}
+    label=${name#*@}
+    insns=$(wc -l <"$loop")
+    for cpu in $cpus; do
+        "$MCA" -mcpu="$cpu" -iterations=100 "$loop" 2>/dev/null | awk \
+            -v kernel="$kernel" -v label="$label" -v insns="$insns" \
+            -v cpu="$cpu" '
+            /^Iterations:/ { iterations = $2 }
+            /^Total Cycles:/ { cycles = $3 }
+            /^\[[0-9.]+\][ \t]+- / { resource[$1] = $3 }
+            /^Resource pressure per iteration:/ { state = 1; next }
+            state == 1 { for (i = 1; i <= NF; ++i) column[i] = $i; state = 2
+                         next }
+            state == 2 {
+                for (i = 1; i <= NF; ++i)
+                    if ($i != "-" && $i + 0 > max) {
+                        max = $i + 0
+                        worst = resource[column[i]]
+                    }
+                state = 0
+            }
+            END {
+                if (!iterations)
+                    exit
+                printf "%-30s %-10s %6d %-16s %12.2f  %s (%.2f)\n", kernel,
+                    label, insns, cpu, cycles / iterations, worst, max
+            }'
+    done
+done
@@ -18,20 +18,70 @@
  * Matthew Fernandez, 2011
  */
 
+/* The benchmarks at the bottom of this file pin threads to CPUs, which needs
+ * the GNU extensions to sched.h and pthread.h.
+ */
+#define _GNU_SOURCE
+
 #include <string.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <assert.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <math.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <linux/userfaultfd.h>
+#if defined(__x86_64__) || defined(__i386__)
+    #include <cpuid.h>
+    #include <immintrin.h>
+#endif
+
+#include "memset.h"
 
 /* Just for convenience let's setup a type for bytes. */
 typedef unsigned char byte;
 
+/* Before we start, a word of warning. Modern compilers are clever enough to
+ * recognise a loop that sets consecutive bytes to the same value and will
+ * helpfully replace it with a call to memset. That's not much use when the
+ * function you're writing is memset, and it means any benchmark of these
+ * functions is really measuring your C library. We mark each implementation
+ * with AS_WRITTEN to tell the compiler not to do this. GCC needs loop
+ * distribution into library calls turned off, while Clang needs to be told it
+ * can't assume memset is the builtin. Define ALLOW_LOOP_IDIOMS if you want to
+ * see what the compiler would have done.
+ */
+#if defined(ALLOW_LOOP_IDIOMS)
+    #define AS_WRITTEN /* nothing */
+#elif defined(__clang__)
+    #define AS_WRITTEN \
+        __attribute__((no_builtin("memset", "memcpy", "memmove")))
+#elif defined(__GNUC__)
+    #define AS_WRITTEN \
+        __attribute__((optimize("no-tree-loop-distribute-patterns")))
+#else
+    #define AS_WRITTEN /* nothing */
+#endif
+
 /* Let's start off with a fairly naive implementation of memset. This sets
  * memory byte-by-byte. While not being particularly efficient and being
  * slightly braindead, it does have the advantage of being readily
  * understandable and reasonably straightforward to implement without making
  * mistakes.
  */
+AS_WRITTEN
 void* bytewise_memset(void* s, int c, size_t sz) {
     byte* p = (byte*)s;
 
@@ -50,6 +100,7 @@ void* bytewise_memset(void* s, int c, size_t sz) {
  * be more efficient than those at finer granularities. Let's take a look at
  * memset for a 32-bit architecture.
  */
+AS_WRITTEN
 void* wordwise_32_memset(void* s, int c, size_t sz) {
     uint32_t* p = (uint32_t*)s;
 
@@ -83,6 +134,7 @@ void* wordwise_32_memset(void* s, int c, size_t sz) {
  * useful thought exercise. Note that GCC defines the handy constant __WORDSIZE
  * that tells us the size (in bits) of words on this architecture.
  */
+AS_WRITTEN
 void* wordwise_memset(void* s, int c, size_t sz) {
     uintptr_t* p = (uintptr_t*)s;
     uintptr_t x = c & 0xff;
@@ -137,6 +189,7 @@ void* wordwise_memset(void* s, int c, size_t sz) {
  *                      |0|0|0|0|0|0|0|
  *                      +-+-+-+-+-+-+-+
  */
+AS_WRITTEN
 void* wordwise_32_unaligned_memset(void* s, int c, size_t sz) {
     uint32_t* p;
     uint32_t x = c & 0xff;
@@ -145,9 +198,10 @@ void* wordwise_32_unaligned_memset(void* s, int c, size_t sz) {
     size_t tail;
 
     /* Let's introduce a prologue to bump the starting location forward to the
-     * next alignment boundary.
+     * next alignment boundary. Careful: decrementing sz in the loop condition
+     * would wrap it around when it runs out before we reach the boundary.
      */
-    while (((unsigned int)pp & 3) && sz--)
+    for (; ((uintptr_t)pp & 3) && sz; --sz)
         *pp++ = xx;
     p = (uint32_t*)pp;
 
@@ -180,6 +234,7 @@ void* wordwise_32_unaligned_memset(void* s, int c, size_t sz) {
  * caveat as for wordwise_memset applies; you wouldn't write code like this in
  * real life.
  */
+AS_WRITTEN
 void* wordwise_unaligned_memset(void* s, int c, size_t sz) {
     uintptr_t* p;
     uintptr_t x = c & 0xff;
@@ -194,7 +249,7 @@ void* wordwise_unaligned_memset(void* s, int c, size_t sz) {
     bytes_per_word = 1<<(i-3);
 
     /* Prologue. */
-    while (((unsigned int)pp & (bytes_per_word-1)) && sz--)
+    for (; ((uintptr_t)pp & (bytes_per_word-1)) && sz; --sz)
         *pp++ = xx;
     tail = sz & (bytes_per_word-1);
     p = (uintptr_t*)pp;
@@ -222,6 +277,7 @@ void* wordwise_unaligned_memset(void* s, int c, size_t sz) {
  * know the fastest algorithm for a given scenario you really have no choice
  * but to look at the generated assembly code.
  */
+AS_WRITTEN
 void* duffs_device_memset(void* s, int c, size_t sz) {
     byte* p = (byte*)s;
     byte x = c & 0xff;
@@ -251,63 +307,4135 @@ void* duffs_device_memset(void* s, int c, size_t sz) {
     return s;
 }
 
-/* Lines below here are instrumentation for testing your implementation. */
+/* Everything so far has been about speed, but speed in a microbenchmark isn't
+ * the whole story. The code for an unrolled or vectorised memset can run to a
+ * couple of kilobytes, and in a large program with a big instruction footprint
+ * that code may well not be in the instruction cache when memset is called. The
+ * fastest memset in isolation can then lose overall. Let's look at some
+ * implementations that keep their footprint to a minimum. We ask the compiler
+ * to optimise these for size rather than speed.
+ */
+#if defined(ALLOW_LOOP_IDIOMS) || !defined(__GNUC__)
+    #define COMPACT AS_WRITTEN
+#elif defined(__clang__)
+    #define COMPACT AS_WRITTEN __attribute__((minsize))
+#else
+    #define COMPACT \
+        __attribute__((optimize("Os", "no-tree-loop-distribute-patterns")))
+#endif
+
+/* This is wordwise_unaligned_memset boiled down to its essentials. There's a
+ * neat trick for constructing the word to write here too; UINTPTR_MAX / 0xff is
+ * 0x0101...01, so multiplying it by the byte copies the byte into every byte of
+ * the word.
+ */
+COMPACT
+void* compact_memset(void* s, int c, size_t sz) {
+    byte* p = (byte*)s;
+    uintptr_t x = (uintptr_t)(c & 0xff) * (UINTPTR_MAX / 0xff);
+
+    for (; sz && ((uintptr_t)p & (sizeof(x) - 1)); --sz)
+        *p++ = c;
+    for (; sz >= sizeof(x); sz -= sizeof(x), p += sizeof(x))
+        *(uintptr_t*)p = x;
+    for (; sz; --sz)
+        *p++ = c;
+    return s;
+}
 
-#define CHECK(f, unaligned) \
-    do { \
-        int fail_byte = check_memset((f), (unaligned)); \
-        if (fail_byte) \
-            printf("%s %s check failed on byte %d.\n", \
-                   (unaligned) ? "Unaligned" : "Aligned", #f, fail_byte - 1); \
-    } while(0)
+/* On x86 there's an even smaller option. The string instruction rep stosb
+ * stores the byte in al to rcx bytes starting at rdi, and the whole function
+ * is a handful of bytes. For a long time this was much slower than a decent
+ * loop, but processors since Ivy Bridge advertise "enhanced rep movsb/stosb"
+ * (ERMS) and implement it in microcode that writes whole cache lines at once.
+ * It still has a noticeable startup cost for small sizes, although more recent
+ * processors with "fast short rep stosb" have improved that too.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+void* rep_stosb_memset(void* s, int c, size_t sz) {
+    void* p = s;
 
-#define BUFFER_LEN 4096
+    __asm__ __volatile__ ("rep stosb"
+                          : "+D" (p), "+c" (sz)
+                          : "a" (c)
+                          : "memory");
+    return s;
+}
+#endif
 
-/* This function does some very basic checking of your memset function. If you
- * really want to comprehensively test your function you should check the
- * regions either side of the memory you are setting to make sure your function
- * is actually obeying the limits passed to it.
+/* The word-wise implementations above are limited to storing a word at a time,
+ * but most processors these days have vector registers and can store 16, 32 or
+ * even 64 bytes in one instruction. Let's write a couple of implementations for
+ * x86 using SSE2 (16 byte vectors, available on every x86-64 processor) and
+ * AVX2 (32 byte vectors). We use the compiler's intrinsics rather than
+ * assembly, and the target attribute lets us use AVX2 in just these functions
+ * without requiring it of the whole program.
  *
- * Note, the argument unaligned determines whether we pass an unaligned pointer
- * and size or not. Only certain of the above implementations will pass this
- * test.
+ * These also use a trick that avoids the fiddly prologue and epilogue loops of
+ * wordwise_unaligned_memset. Unaligned vector stores are cheap on modern
+ * processors, so we do one unaligned store at the start and one ending exactly
+ * at the end of the region, then fill in between with aligned stores. Some
+ * bytes get written twice, but that's much cheaper than the branches needed to
+ * avoid it. Sizes smaller than a vector are handled the same way with smaller
+ * stores (see fast_memset in memset.h).
  */
-int check_memset(void* f(), int unaligned) {
-    char buffer[BUFFER_LEN];
-    int i;
-    char set;
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+void* sse2_memset(void* s, int c, size_t sz) {
+    byte* p = (byte*)s;
+    byte* end = p + sz;
+    byte* q;
+    __m128i v;
+
+    if (sz < 16)
+        return fast_memset(s, c, sz);
+
+    v = _mm_set1_epi8((char)c);
+    _mm_storeu_si128((__m128i*)p, v);
+    _mm_storeu_si128((__m128i*)(end - 16), v);
+    if (sz <= 32)
+        return s;
+
+    /* Aligned stores from the first 16 byte boundary after p, four at a time
+     * while we can, then singly. The unaligned store above has the end covered.
+     */
+    q = (byte*)(((uintptr_t)p + 16) & ~(uintptr_t)15);
+    for (; q + 64 <= end; q += 64) {
+        _mm_store_si128((__m128i*)q, v);
+        _mm_store_si128((__m128i*)(q + 16), v);
+        _mm_store_si128((__m128i*)(q + 32), v);
+        _mm_store_si128((__m128i*)(q + 48), v);
+    }
+    for (; q + 16 <= end; q += 16)
+        _mm_store_si128((__m128i*)q, v);
+    return s;
+}
+
+__attribute__((target("avx2")))
+void* avx2_memset(void* s, int c, size_t sz) {
+    byte* p = (byte*)s;
+    byte* end = p + sz;
+    byte* q;
+    __m256i v;
+
+    if (sz < 32)
+        return sz < 16 ? fast_memset(s, c, sz) : sse2_memset(s, c, sz);
+
+    v = _mm256_set1_epi8((char)c);
+    _mm256_storeu_si256((__m256i*)p, v);
+    _mm256_storeu_si256((__m256i*)(end - 32), v);
+    if (sz <= 64)
+        return s;
+
+    q = (byte*)(((uintptr_t)p + 32) & ~(uintptr_t)31);
+    for (; q + 128 <= end; q += 128) {
+        _mm256_store_si256((__m256i*)q, v);
+        _mm256_store_si256((__m256i*)(q + 32), v);
+        _mm256_store_si256((__m256i*)(q + 64), v);
+        _mm256_store_si256((__m256i*)(q + 96), v);
+    }
+    for (; q + 32 <= end; q += 32)
+        _mm256_store_si256((__m256i*)q, v);
+    return s;
+}
+
+/* All the stores so far go through the cache, which is what you want if the
+ * memory is about to be used. If it isn't, filling a large region just evicts
+ * everything else from the cache to make room for lines nobody will read, and
+ * each of those lines has to be read from memory before it's written (a "read
+ * for ownership"). Non-temporal stores bypass the cache and write whole lines
+ * straight to memory. They are weakly ordered, so we finish with an sfence to
+ * make sure they're visible to other processors before we return.
+ */
+__attribute__((target("sse2")))
+void* nt_memset(void* s, int c, size_t sz) {
+    byte* p = (byte*)s;
+    byte* end = p + sz;
+    byte* q;
+    __m128i v;
+
+    if (sz <= 64)
+        return fast_memset(s, c, sz);
+
+    v = _mm_set1_epi8((char)c);
+    _mm_storeu_si128((__m128i*)p, v);
+    _mm_storeu_si128((__m128i*)(end - 16), v);
+    q = (byte*)(((uintptr_t)p + 16) & ~(uintptr_t)15);
+    for (; q + 64 <= end; q += 64) {
+        _mm_stream_si128((__m128i*)q, v);
+        _mm_stream_si128((__m128i*)(q + 16), v);
+        _mm_stream_si128((__m128i*)(q + 32), v);
+        _mm_stream_si128((__m128i*)(q + 48), v);
+    }
+    for (; q + 16 <= end; q += 16)
+        _mm_stream_si128((__m128i*)q, v);
+    _mm_sfence();
+    return s;
+}
+
+/* Whether the processor supports AVX2 and ERMS respectively. */
+static int have_avx2(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+static int have_erms(void) {
+    unsigned int a, b, c, d;
+
+    return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1 << 9));
+}
+
+/* Write back each cache line of a region to memory. clwb leaves the line in
+ * the cache, clflushopt evicts it; either is much cheaper than the old clflush,
+ * which is serialising. Both are weakly ordered, hence the sfence.
+ */
+__attribute__((target("clwb")))
+static void clwb_lines(byte* p, byte* end) {
+    for (p = (byte*)((uintptr_t)p & ~(uintptr_t)63); p < end; p += 64)
+        _mm_clwb(p);
+    _mm_sfence();
+}
+
+__attribute__((target("clflushopt")))
+static void clflushopt_lines(byte* p, byte* end) {
+    for (p = (byte*)((uintptr_t)p & ~(uintptr_t)63); p < end; p += 64)
+        _mm_clflushopt(p);
+    _mm_sfence();
+}
+
+static void (*line_flush(void))(byte*, byte*) {
+    unsigned int a, b, c, d;
+
+    if (!__get_cpuid_count(7, 0, &a, &b, &c, &d))
+        return NULL;
+    return b & (1 << 24) ? clwb_lines : b & (1 << 23) ? clflushopt_lines : NULL;
+}
+#endif
+
+/* Copying has the same shape as filling, just with a load before each store,
+ * and the same tricks work: unaligned stores at the start and the end, aligned
+ * ones in between. It's actually simpler to write memmove than memcpy, since
+ * we have to load the first and last vectors before storing anything anyway.
+ * If the ranges overlap with the destination above the source, copying
+ * forwards would overwrite source bytes before we'd read them, so we go
+ * backwards instead. Either way every load in the loop reads source bytes that
+ * no earlier store has touched. memcpy_bulk uses these too; the direction check
+ * costs next to nothing.
+ */
+AS_WRITTEN
+void* wordwise_memmove(void* dst, const void* src, size_t n) {
+    byte* d = (byte*)dst;
+    const byte* s = (const byte*)src;
+    byte* end = d + n;
+    byte* q;
+    uint64_t head, tail, x;
+
+    if (n <= 64)
+        return fast_memmove(dst, src, n);
+
+    MEMSET_LOAD(memset_u64, head, s);
+    MEMSET_LOAD(memset_u64, tail, s + n - sizeof(x));
+    if ((uintptr_t)d - (uintptr_t)s >= n) {
+        q = (byte*)(((uintptr_t)d + sizeof(x)) & ~(uintptr_t)(sizeof(x) - 1));
+        for (; q < end - sizeof(x); q += sizeof(x)) {
+            MEMSET_LOAD(memset_u64, x, s + (q - d));
+            *(uint64_t*)q = x;
+        }
+    } else {
+        q = (byte*)((uintptr_t)end & ~(uintptr_t)(sizeof(x) - 1));
+        while (q > d + sizeof(x)) {
+            q -= sizeof(x);
+            MEMSET_LOAD(memset_u64, x, s + (q - d));
+            *(uint64_t*)q = x;
+        }
+    }
+    MEMSET_STORE(memset_u64, d, head);
+    MEMSET_STORE(memset_u64, end - sizeof(x), tail);
+    return dst;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+void* rep_movsb_memcpy(void* dst, const void* src, size_t n) {
+    void* d = dst;
+
+    __asm__ __volatile__ ("rep movsb"
+                          : "+D" (d), "+S" (src), "+c" (n)
+                          :
+                          : "memory");
+    return dst;
+}
+
+__attribute__((target("sse2")))
+void* sse2_memmove(void* dst, const void* src, size_t n) {
+    byte* d = (byte*)dst;
+    const byte* s = (const byte*)src;
+    byte* end = d + n;
+    byte* q;
+    __m128i head, tail, v0, v1, v2, v3;
+
+    if (n <= 64)
+        return fast_memmove(dst, src, n);
+
+    head = _mm_loadu_si128((const __m128i*)s);
+    tail = _mm_loadu_si128((const __m128i*)(s + n - 16));
+    if ((uintptr_t)d - (uintptr_t)s >= n) {
+        q = (byte*)(((uintptr_t)d + 16) & ~(uintptr_t)15);
+        for (; q + 64 < end - 16; q += 64) {
+            v0 = _mm_loadu_si128((const __m128i*)(s + (q - d)));
+            v1 = _mm_loadu_si128((const __m128i*)(s + (q - d) + 16));
+            v2 = _mm_loadu_si128((const __m128i*)(s + (q - d) + 32));
+            v3 = _mm_loadu_si128((const __m128i*)(s + (q - d) + 48));
+            _mm_store_si128((__m128i*)q, v0);
+            _mm_store_si128((__m128i*)(q + 16), v1);
+            _mm_store_si128((__m128i*)(q + 32), v2);
+            _mm_store_si128((__m128i*)(q + 48), v3);
+        }
+        for (; q < end - 16; q += 16)
+            _mm_store_si128((__m128i*)q,
+                            _mm_loadu_si128((const __m128i*)(s + (q - d))));
+    } else {
+        q = (byte*)((uintptr_t)end & ~(uintptr_t)15);
+        for (; q - 64 > d + 16; q -= 64) {
+            v0 = _mm_loadu_si128((const __m128i*)(s + (q - d) - 16));
+            v1 = _mm_loadu_si128((const __m128i*)(s + (q - d) - 32));
+            v2 = _mm_loadu_si128((const __m128i*)(s + (q - d) - 48));
+            v3 = _mm_loadu_si128((const __m128i*)(s + (q - d) - 64));
+            _mm_store_si128((__m128i*)(q - 16), v0);
+            _mm_store_si128((__m128i*)(q - 32), v1);
+            _mm_store_si128((__m128i*)(q - 48), v2);
+            _mm_store_si128((__m128i*)(q - 64), v3);
+        }
+        for (; q > d + 16; q -= 16)
+            _mm_store_si128((__m128i*)(q - 16),
+                            _mm_loadu_si128((const __m128i*)(s + (q - d) - 16)));
+    }
+    _mm_storeu_si128((__m128i*)d, head);
+    _mm_storeu_si128((__m128i*)(end - 16), tail);
+    return dst;
+}
+
+__attribute__((target("avx2")))
+void* avx2_memmove(void* dst, const void* src, size_t n) {
+    byte* d = (byte*)dst;
+    const byte* s = (const byte*)src;
+    byte* end = d + n;
+    byte* q;
+    __m256i head, tail, v0, v1, v2, v3;
+
+    if (n <= 64)
+        return fast_memmove(dst, src, n);
+
+    head = _mm256_loadu_si256((const __m256i*)s);
+    tail = _mm256_loadu_si256((const __m256i*)(s + n - 32));
+    if ((uintptr_t)d - (uintptr_t)s >= n) {
+        q = (byte*)(((uintptr_t)d + 32) & ~(uintptr_t)31);
+        for (; q + 128 < end - 32; q += 128) {
+            v0 = _mm256_loadu_si256((const __m256i*)(s + (q - d)));
+            v1 = _mm256_loadu_si256((const __m256i*)(s + (q - d) + 32));
+            v2 = _mm256_loadu_si256((const __m256i*)(s + (q - d) + 64));
+            v3 = _mm256_loadu_si256((const __m256i*)(s + (q - d) + 96));
+            _mm256_store_si256((__m256i*)q, v0);
+            _mm256_store_si256((__m256i*)(q + 32), v1);
+            _mm256_store_si256((__m256i*)(q + 64), v2);
+            _mm256_store_si256((__m256i*)(q + 96), v3);
+        }
+        for (; q < end - 32; q += 32)
+            _mm256_store_si256((__m256i*)q,
+                _mm256_loadu_si256((const __m256i*)(s + (q - d))));
+    } else {
+        q = (byte*)((uintptr_t)end & ~(uintptr_t)31);
+        for (; q - 128 > d + 32; q -= 128) {
+            v0 = _mm256_loadu_si256((const __m256i*)(s + (q - d) - 32));
+            v1 = _mm256_loadu_si256((const __m256i*)(s + (q - d) - 64));
+            v2 = _mm256_loadu_si256((const __m256i*)(s + (q - d) - 96));
+            v3 = _mm256_loadu_si256((const __m256i*)(s + (q - d) - 128));
+            _mm256_store_si256((__m256i*)(q - 32), v0);
+            _mm256_store_si256((__m256i*)(q - 64), v1);
+            _mm256_store_si256((__m256i*)(q - 96), v2);
+            _mm256_store_si256((__m256i*)(q - 128), v3);
+        }
+        for (; q > d + 32; q -= 32)
+            _mm256_store_si256((__m256i*)(q - 32),
+                _mm256_loadu_si256((const __m256i*)(s + (q - d) - 32)));
+    }
+    _mm256_storeu_si256((__m256i*)d, head);
+    _mm256_storeu_si256((__m256i*)(end - 32), tail);
+    return dst;
+}
+
+/* Non-temporal stores for copies too big to stay in the cache. Only for
+ * ranges that don't overlap at all.
+ */
+__attribute__((target("sse2")))
+void* nt_memcpy(void* dst, const void* src, size_t n) {
+    byte* d = (byte*)dst;
+    const byte* s = (const byte*)src;
+    byte* end = d + n;
+    byte* q;
+    __m128i head, tail, v0, v1, v2, v3;
+
+    if (n <= 64)
+        return fast_memcpy(dst, src, n);
+
+    head = _mm_loadu_si128((const __m128i*)s);
+    tail = _mm_loadu_si128((const __m128i*)(s + n - 16));
+    q = (byte*)(((uintptr_t)d + 16) & ~(uintptr_t)15);
+    for (; q + 64 < end - 16; q += 64) {
+        v0 = _mm_loadu_si128((const __m128i*)(s + (q - d)));
+        v1 = _mm_loadu_si128((const __m128i*)(s + (q - d) + 16));
+        v2 = _mm_loadu_si128((const __m128i*)(s + (q - d) + 32));
+        v3 = _mm_loadu_si128((const __m128i*)(s + (q - d) + 48));
+        _mm_stream_si128((__m128i*)q, v0);
+        _mm_stream_si128((__m128i*)(q + 16), v1);
+        _mm_stream_si128((__m128i*)(q + 32), v2);
+        _mm_stream_si128((__m128i*)(q + 48), v3);
+    }
+    for (; q < end - 16; q += 16)
+        _mm_stream_si128((__m128i*)q,
+                         _mm_loadu_si128((const __m128i*)(s + (q - d))));
+    _mm_sfence();
+    _mm_storeu_si128((__m128i*)d, head);
+    _mm_storeu_si128((__m128i*)(end - 16), tail);
+    return dst;
+}
+#endif
+
+/* Some callers only ever fill whole cache lines or pages, which are already
+ * aligned: a slab allocator, say. For them the unaligned head and tail stores
+ * and the size checks above are wasted, so here are loops that do nothing but
+ * store whole lines. We assume 64 byte lines, which is right for every x86
+ * processor of the last twenty years and most other things besides.
+ */
+#define LINE_SIZE 64
+
+AS_WRITTEN
+static void word_lines(byte* p, size_t nlines, int c) {
+    uintptr_t x = (uintptr_t)(c & 0xff) * (UINTPTR_MAX / 0xff);
+    uintptr_t* q = (uintptr_t*)p;
+    uintptr_t* end = (uintptr_t*)(p + nlines * LINE_SIZE);
+    unsigned int i;
+
+    for (; q < end; q += LINE_SIZE / sizeof(x))
+        for (i = 0; i < LINE_SIZE / sizeof(x); ++i)
+            q[i] = x;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static void sse2_lines(byte* p, size_t nlines, int c) {
+    __m128i v = _mm_set1_epi8((char)c);
+    byte* end = p + nlines * LINE_SIZE;
+
+    for (; p < end; p += LINE_SIZE) {
+        _mm_store_si128((__m128i*)p, v);
+        _mm_store_si128((__m128i*)(p + 16), v);
+        _mm_store_si128((__m128i*)(p + 32), v);
+        _mm_store_si128((__m128i*)(p + 48), v);
+    }
+}
+
+__attribute__((target("avx2")))
+static void avx2_lines(byte* p, size_t nlines, int c) {
+    __m256i v = _mm256_set1_epi8((char)c);
+    byte* end = p + nlines * LINE_SIZE;
+
+    for (; p < end; p += LINE_SIZE) {
+        _mm256_store_si256((__m256i*)p, v);
+        _mm256_store_si256((__m256i*)(p + 32), v);
+    }
+}
+#endif
+
+/* Finally, let's put the pieces together into something you could actually
+ * call. Which implementation is best depends on the processor, so memset_bulk
+ * works it out the first time it's called and then sticks with it. With ERMS,
+ * rep stosb beats a vector loop once the size is large enough to amortise its
+ * startup cost, so we switch to it above a threshold. Fills too big to fit in
+ * the last level cache are unlikely to be read back before they're evicted, so
+ * above three quarters of its size we use non-temporal stores. The small sizes
+ * are dealt with inline by fast_memset in memset.h, which only calls
+ * memset_bulk for sizes over 64 bytes.
+ */
+static struct {
+    void* (*impl)(void*, int, size_t);
+    const char* name;
+    size_t erms_threshold; /* Use rep stosb from this size up; 0 for never. */
+    void* (*nt_impl)(void*, int, size_t);    /* NULL if none, or off. */
+    size_t nt_threshold;   /* Use nt_impl from this size up; 0 for never. */
+    void (*lines)(byte*, size_t, int);
+    size_t page;
+    void* (*copy)(void*, const void*, size_t);    /* A memmove. */
+    void* (*nt_copy)(void*, const void*, size_t);
+    int overridden;        /* Whether the environment changed anything. */
+    const char* tuning;    /* Name of the entry in tunings used. */
+} dispatch;
 
-    for (set = 0; (unsigned int)set <= 0xff; ++set) {
-        f(buffer + unaligned, set, BUFFER_LEN - 2*unaligned);
-        for (i = unaligned; i < BUFFER_LEN - 2*unaligned; ++i)
-            if (buffer[i] != set)
-                return i + 1;
+static pthread_once_t dispatch_once = PTHREAD_ONCE_INIT;
+
+/* The last resort, for when all of ours are suspect. */
+static void libc_lines(byte* p, size_t nlines, int c) {
+    memset(p, c, nlines * LINE_SIZE);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static void erms_lines(byte* p, size_t nlines, int c) {
+    rep_stosb_memset(p, c, nlines * LINE_SIZE);
+}
+#endif
+
+/* Use the named family of implementations, if this processor can. */
+static int dispatch_use(const char* name) {
+    if (!strcmp(name, "word")) {
+        dispatch.name = "word";
+        dispatch.impl = wordwise_unaligned_memset;
+        dispatch.lines = word_lines;
+        dispatch.copy = wordwise_memmove;
+    } else if (!strcmp(name, "libc")) {
+        dispatch.name = "libc";
+        dispatch.impl = memset;
+        dispatch.lines = libc_lines;
+        dispatch.copy = memmove;
+#if defined(__x86_64__) || defined(__i386__)
+    } else if (!strcmp(name, "sse2") && __builtin_cpu_supports("sse2")) {
+        dispatch.name = "sse2";
+        dispatch.impl = sse2_memset;
+        dispatch.lines = sse2_lines;
+        dispatch.copy = sse2_memmove;
+    } else if (!strcmp(name, "avx2") && have_avx2()) {
+        dispatch.name = "avx2";
+        dispatch.impl = avx2_memset;
+        dispatch.lines = avx2_lines;
+        dispatch.copy = avx2_memmove;
+#endif
+    } else {
+        return -1;
     }
+    return 0;
+}
+
+/* Read a size in bytes, with an optional K, M or G suffix, from the
+ * environment. Returns -1 if the variable isn't set or isn't a size.
+ */
+static int env_size(const char* name, size_t* size) {
+    const char* s = getenv(name);
+    char* end;
+    unsigned long long n;
 
+    if (!s || !*s)
+        return -1;
+    n = strtoull(s, &end, 0);
+    switch (*end) {
+        case 'k': case 'K': n <<= 10; ++end; break;
+        case 'm': case 'M': n <<= 20; ++end; break;
+        case 'g': case 'G': n <<= 30; ++end; break;
+    }
+    if (*end)
+        return -1;
+    *size = n;
     return 0;
 }
 
-/* When executed, this program will just validate the implementations in this
- * file. Note that the unaligned tests are only run on the functions that can
- * cope with unaligned values.
+/* Feature bits only tell us what a processor can do, not what it's good at.
+ * How early rep stosb overtakes a vector loop, for instance, differs a lot
+ * between cores that all advertise ERMS. So we start from a table of settings
+ * for the cores we know, picked by CPUID vendor, family and model, with a
+ * generic entry (the last) for everything else. These are starting points:
+ * "memset bench" on the machine in question has the final word, and the
+ * environment variables below can change them.
+ *
+ * None of these use AVX-512. On Skylake-SP in particular, 512-bit stores drop
+ * the whole core to a lower clock frequency for some time afterwards, which
+ * costs code that only fills memory now and then more than the wider stores
+ * save.
  */
-int main(int argc, char** argv) {
+struct tuning {
+    const char* name;
+    const char* vendor;        /* NULL for any. */
+    unsigned int family;
+    unsigned int model_lo, model_hi;
+    const char* impl;          /* NULL for the best the processor supports. */
+    size_t erms_threshold;     /* Use rep stosb from this size up; 0 for
+                                  never. Only with ERMS. */
+    unsigned int nt_percent;   /* Of the last level cache, for nt_threshold;
+                                  0 for never. */
+};
+
+static const struct tuning tunings[] = {
+    /* Skylake-SP and Cascade Lake. rep stosb has a noticeable startup cost. */
+    { "skylake-sp", "GenuineIntel", 6, 0x55, 0x55, "avx2", 2048, 75 },
+
+    /* Ice Lake and later have "fast short rep mov", and rep stosb pays off
+     * sooner. Sapphire Rapids (and Emerald Rapids) sooner still.
+     */
+    { "icelake-sp", "GenuineIntel", 6, 0x6a, 0x6c, "avx2", 1024, 75 },
+    { "icelake", "GenuineIntel", 6, 0x7d, 0x7e, "avx2", 1024, 75 },
+    { "sapphirerapids", "GenuineIntel", 6, 0x8f, 0x8f, "avx2", 512, 75 },
+    { "sapphirerapids", "GenuineIntel", 6, 0xcf, 0xcf, "avx2", 512, 75 },
+
+    /* On Zen 2 rep stosb is slow to start and AVX2 stores win until fills
+     * are large. Zen 3 added fast short rep mov and Zen 4 kept it. Each CCX
+     * has its own L3, which is what the processor reports, so a fill that
+     * doesn't fit is going to memory anyway.
+     */
+    { "zen2", "AuthenticAMD", 0x17, 0x30, 0xff, "avx2", 32 << 10, 75 },
+    { "zen3", "AuthenticAMD", 0x19, 0x00, 0x0f, "avx2", 2048, 75 },
+    { "zen4", "AuthenticAMD", 0x19, 0x10, 0x1f, "avx2", 2048, 75 },
+    { "zen3", "AuthenticAMD", 0x19, 0x20, 0x5f, "avx2", 2048, 75 },
+    { "zen4", "AuthenticAMD", 0x19, 0x60, 0x7f, "avx2", 2048, 75 },
+    { "zen4", "AuthenticAMD", 0x19, 0xa0, 0xaf, "avx2", 2048, 75 },
+
+    { "generic", NULL, 0, 0, 0, NULL, 2048, 75 },
+};
+
+#define TUNINGS (sizeof(tunings) / sizeof(tunings[0]))
+
+static const struct tuning* find_tuning(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int a, b, c, d, family, model, i;
+    char vendor[13];
+
+    if (__get_cpuid(0, &a, &b, &c, &d)) {
+        memcpy(vendor, &b, 4);
+        memcpy(vendor + 4, &d, 4);
+        memcpy(vendor + 8, &c, 4);
+        vendor[12] = '\0';
+        if (__get_cpuid(1, &a, &b, &c, &d)) {
+            family = (a >> 8) & 0xf;
+            model = (a >> 4) & 0xf;
+            if (family == 6 || family == 0xf)
+                model |= ((a >> 16) & 0xf) << 4;
+            if (family == 0xf)
+                family += (a >> 20) & 0xff;
+            for (i = 0; i < TUNINGS - 1; ++i)
+                if (!strcmp(tunings[i].vendor, vendor) &&
+                    tunings[i].family == family &&
+                    model >= tunings[i].model_lo &&
+                    model <= tunings[i].model_hi)
+                    return &tunings[i];
+        }
+    }
+#endif
+    return &tunings[TUNINGS - 1];
+}
+
+/* Having chosen for ourselves, we let the environment overrule us, so that a
+ * misbehaving implementation can be switched off (or a new one tried out on
+ * some processes) without rebuilding anything:
+ *
+ *   MEMSET_IMPL            avx2, sse2 or word to use only that family of
+ *                          implementations, without rep stosb; erms to use
+ *                          rep stosb for every size and for memset_lines,
+ *                          without non-temporal stores, and rep movsb for
+ *                          every copy that can go forwards; libc to hand
+ *                          everything to the C library.
+ *   MEMSET_ERMS_THRESHOLD  use rep stosb from this size up (0 for never).
+ *   MEMSET_NT_THRESHOLD    use non-temporal stores from this size up (0 for
+ *                          never).
+ *
+ * Turning non-temporal stores off, with MEMSET_NT_THRESHOLD=0, erms or libc,
+ * turns them off everywhere, including in memset_ex and durable_fill, which
+ * would otherwise use them whatever the size. A nonzero MEMSET_NT_THRESHOLD
+ * turns them back on after erms, but not after libc.
+ *
+ * An implementation this processor doesn't support is ignored, and
+ * memset_bulk_query says what was actually chosen. The thresholds apply after
+ * MEMSET_IMPL. All of them are read once, the first time any of these
+ * functions is called.
+ */
+static void dispatch_init(void) {
+    const struct tuning* t = find_tuning();
+    const char* impl = getenv("MEMSET_IMPL");
+    void* (*nt_impl)(void*, int, size_t) = NULL;
+    void* (*nt_copy)(void*, const void*, size_t) = NULL;
+    long llc = 0;
+    size_t size;
+
+    dispatch.erms_threshold = 0;
+    dispatch.nt_impl = NULL;
+    dispatch.nt_copy = NULL;
+    dispatch.page = sysconf(_SC_PAGESIZE);
+    dispatch.overridden = 0;
+    dispatch.tuning = t->name;
+    if ((!t->impl || dispatch_use(t->impl)) && dispatch_use("avx2") &&
+        dispatch_use("sse2"))
+        dispatch_use("word");
+#if defined(__x86_64__) || defined(__i386__)
+    if (have_erms())
+        dispatch.erms_threshold = t->erms_threshold;
+    if (__builtin_cpu_supports("sse2")) {
+        dispatch.nt_impl = nt_impl = nt_memset;
+        dispatch.nt_copy = nt_copy = nt_memcpy;
+    }
+#endif
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+#endif
+    dispatch.nt_threshold = dispatch.nt_impl && llc > 0
+                            ? llc / 100 * t->nt_percent : 0;
+
+    if (impl && !strcmp(impl, "libc") && !dispatch_use("libc")) {
+        dispatch.erms_threshold = 0;
+        dispatch.nt_impl = NULL;
+        dispatch.nt_copy = NULL;
+        dispatch.nt_threshold = 0;
+        dispatch.overridden = 1;
+#if defined(__x86_64__) || defined(__i386__)
+    } else if (impl && !strcmp(impl, "erms") && have_erms()) {
+        dispatch.name = "erms";
+        dispatch.impl = rep_stosb_memset;
+        dispatch.lines = erms_lines;
+        dispatch.erms_threshold = 1;
+        dispatch.nt_impl = NULL;
+        dispatch.nt_copy = NULL;
+        dispatch.nt_threshold = 0;
+        dispatch.overridden = 1;
+#endif
+    } else if (impl && !dispatch_use(impl)) {
+        dispatch.erms_threshold = 0;
+        dispatch.overridden = 1;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    if (!env_size("MEMSET_ERMS_THRESHOLD", &size)) {
+        dispatch.erms_threshold = size;
+        dispatch.overridden = 1;
+    }
+#endif
+    if (nt_impl && dispatch.impl != memset &&
+        !env_size("MEMSET_NT_THRESHOLD", &size)) {
+        dispatch.nt_threshold = size;
+        dispatch.nt_impl = size ? nt_impl : NULL;
+        dispatch.nt_copy = size ? nt_copy : NULL;
+        dispatch.overridden = 1;
+    }
+}
+
+/* Fill through the cache, whatever the size. */
+static void* cached_fill(void* s, int c, size_t n) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (dispatch.erms_threshold && n >= dispatch.erms_threshold)
+        return rep_stosb_memset(s, c, n);
+#endif
+    return dispatch.impl(s, c, n);
+}
+
+void* memset_bulk(void* s, int c, size_t n) {
+    pthread_once(&dispatch_once, dispatch_init);
+    if (dispatch.nt_threshold && n >= dispatch.nt_threshold)
+        return dispatch.nt_impl(s, c, n);
+    return cached_fill(s, c, n);
+}
+
+const char* memset_bulk_impl(void) {
+    pthread_once(&dispatch_once, dispatch_init);
+    return dispatch.name;
+}
+
+const char* memset_bulk_impl_for(size_t n) {
+    pthread_once(&dispatch_once, dispatch_init);
+    if (dispatch.nt_threshold && n >= dispatch.nt_threshold)
+        return "nt";
+    if (dispatch.erms_threshold && n >= dispatch.erms_threshold)
+        return "erms";
+    return dispatch.name;
+}
+
+void memset_bulk_query(struct memset_bulk_info* info) {
+    pthread_once(&dispatch_once, dispatch_init);
+    info->impl = dispatch.name;
+    info->erms_threshold = dispatch.erms_threshold;
+    info->nt_threshold = dispatch.nt_threshold;
+    info->overridden = dispatch.overridden;
+    info->tuning = dispatch.tuning;
+}
+
+void memset_lines(void* s, size_t nlines, int c) {
+    pthread_once(&dispatch_once, dispatch_init);
+    dispatch.lines(s, nlines, c);
+}
+
+/* Pages are big enough for rep stosb to be at its best, which is why the
+ * Linux kernel clears pages with it on processors with ERMS. Huge runs of
+ * pages go through the same non-temporal stores as memset_bulk.
+ */
+void clear_pages(void* s, size_t npages) {
+    size_t n;
+
+    pthread_once(&dispatch_once, dispatch_init);
+    n = npages * dispatch.page;
+    if (dispatch.nt_threshold && n >= dispatch.nt_threshold)
+        dispatch.nt_impl(s, 0, n);
+#if defined(__x86_64__) || defined(__i386__)
+    else if (dispatch.erms_threshold && n >= dispatch.erms_threshold)
+        rep_stosb_memset(s, 0, n);
+#endif
+    else
+        dispatch.lines(s, n / LINE_SIZE, 0);
+}
+
+/* The copying counterparts of memset_bulk, with the same thresholds. rep movsb
+ * copies forwards, so memmove can only use it when that's safe; non-temporal
+ * copies need the ranges not to overlap at all.
+ */
+void* memcpy_bulk(void* dst, const void* src, size_t n) {
+    pthread_once(&dispatch_once, dispatch_init);
+    if (dispatch.nt_threshold && n >= dispatch.nt_threshold)
+        return dispatch.nt_copy(dst, src, n);
+#if defined(__x86_64__) || defined(__i386__)
+    if (dispatch.erms_threshold && n >= dispatch.erms_threshold)
+        return rep_movsb_memcpy(dst, src, n);
+#endif
+    return dispatch.copy(dst, src, n);
+}
+
+void* memmove_bulk(void* dst, const void* src, size_t n) {
+    uintptr_t ahead = (uintptr_t)dst - (uintptr_t)src;
+
+    if (ahead >= n && (uintptr_t)src - (uintptr_t)dst >= n)
+        return memcpy_bulk(dst, src, n);
+    pthread_once(&dispatch_once, dispatch_init);
+#if defined(__x86_64__) || defined(__i386__)
+    if (ahead >= n && dispatch.erms_threshold && n >= dispatch.erms_threshold)
+        return rep_movsb_memcpy(dst, src, n);
+#endif
+    return dispatch.copy(dst, src, n);
+}
+
+/* memset_bulk has to guess what's best from the size alone, but the caller
+ * often knows more: whether the memory is about to be read, whether it's fine
+ * to use other cores, whether the pages could simply be handed back to the
+ * kernel. memset_ex takes hints (see memset.h) and uses them to pick a
+ * strategy.
+ */
+#define PARALLEL_MIN_CHUNK (4 << 20)
+#define PARALLEL_MAX_THREADS 16
+#define RELEASE_MIN (1 << 20)
+
+struct chunk {
+    void* (*f)(void*, int, size_t);
+    byte* p;
+    int c;
+    size_t n;
+};
+
+static void* fill_chunk(void* arg) {
+    struct chunk* ch = arg;
+
+    ch->f(ch->p, ch->c, ch->n);
+    return NULL;
+}
+
+/* Split a fill across as many of our CPUs as make sense, giving each thread at
+ * least PARALLEL_MIN_CHUNK bytes. The calling thread does the last chunk. If we
+ * can't create a thread, we do its chunk ourselves.
+ */
+static void parallel_fill(void* (*f)(void*, int, size_t), byte* p, int c,
+                          size_t n) {
+    struct chunk chunks[PARALLEL_MAX_THREADS];
+    pthread_t threads[PARALLEL_MAX_THREADS];
+    int created[PARALLEL_MAX_THREADS];
+    cpu_set_t cpus;
+    size_t per, nthreads = 1, i;
+    byte *start, *next;
+
+    if (!sched_getaffinity(0, sizeof(cpus), &cpus))
+        nthreads = CPU_COUNT(&cpus);
+    if (nthreads > n / PARALLEL_MIN_CHUNK)
+        nthreads = n / PARALLEL_MIN_CHUNK;
+    if (nthreads > PARALLEL_MAX_THREADS)
+        nthreads = PARALLEL_MAX_THREADS;
+    if (nthreads < 2) {
+        f(p, c, n);
+        return;
+    }
+
+    /* Put the boundaries between chunks on cache line boundaries in memory,
+     * not just at multiples of 64 bytes from p, so no two threads write to the
+     * same line. Only the first and last chunks start or end part way through
+     * a line.
+     */
+    per = n / nthreads;
+    for (start = p, i = 0; i < nthreads; ++i, start = next) {
+        next = i + 1 < nthreads
+               ? (byte*)(((uintptr_t)p + (i + 1) * per) & ~(uintptr_t)63)
+               : p + n;
+        if (next < start)
+            next = start;
+        chunks[i].f = f;
+        chunks[i].p = start;
+        chunks[i].c = c;
+        chunks[i].n = next - start;
+    }
+    for (i = 0; i + 1 < nthreads; ++i)
+        created[i] = !pthread_create(&threads[i], NULL, fill_chunk, &chunks[i]);
+    fill_chunk(&chunks[nthreads - 1]);
+    for (i = 0; i + 1 < nthreads; ++i) {
+        if (created[i])
+            pthread_join(threads[i], NULL);
+        else
+            fill_chunk(&chunks[i]);
+    }
+}
+
+void* memset_ex(void* s, int c, size_t n, unsigned flags) {
+    void* (*f)(void*, int, size_t);
+    byte* p = (byte*)s;
+    byte *lo, *hi;
+    long page;
+
+    if (n <= 64)
+        return fast_memset(s, c, n);
+    pthread_once(&dispatch_once, dispatch_init);
+
+    /* The caller expects small fills, so skip all the size class decisions
+     * and use the plain vector loop, which has no startup cost.
+     */
+    if (flags & MEMSET_SMALL_LIKELY)
+        return dispatch.impl(s, c, n);
+
+    /* Zeroing private anonymous memory can be done by the kernel lazily. After
+     * MADV_DONTNEED the pages read as zero and are only allocated again when
+     * next touched. Only whole pages can be released; we fill the partial
+     * pages at either end ourselves.
+     */
+    if ((flags & MEMSET_MAY_RELEASE_PAGES) && !(c & 0xff) && n >= RELEASE_MIN) {
+        page = sysconf(_SC_PAGESIZE);
+        lo = (byte*)(((uintptr_t)p + page - 1) & ~(uintptr_t)(page - 1));
+        hi = (byte*)((uintptr_t)(p + n) & ~(uintptr_t)(page - 1));
+        if (hi > lo && !madvise(lo, hi - lo, MADV_DONTNEED)) {
+            flags &= ~MEMSET_MAY_RELEASE_PAGES;
+            memset_ex(p, c, lo - p, flags);
+            memset_ex(hi, c, p + n - hi, flags);
+            return s;
+        }
+    }
+
+    /* If the memory will be read soon we want it in the cache however big it
+     * is. If not, non-temporal stores save polluting the cache. Otherwise we
+     * fall back to guessing from the size, like memset_bulk.
+     */
+    if (flags & MEMSET_WILL_READ_SOON)
+        f = cached_fill;
+    else if (dispatch.nt_impl && ((flags & MEMSET_NONTEMPORAL) ||
+             (dispatch.nt_threshold && n >= dispatch.nt_threshold)))
+        f = dispatch.nt_impl;
+    else
+        f = cached_fill;
+
+    if ((flags & MEMSET_PARALLEL_OK) && n >= 2 * PARALLEL_MIN_CHUNK)
+        parallel_fill(f, p, c, n);
+    else
+        f(s, c, n);
+    return s;
+}
+
+/* Another situation where memset doesn't quite fit is resetting shared memory
+ * that other threads may be reading at the same time without taking a lock. C
+ * says nothing about what such a reader sees while memset is running. In
+ * practice the compiler is free to split, merge or reorder the stores, so a
+ * reader can see a word that is half old and half new. atomic_fill writes each
+ * naturally aligned 8 byte word with a single relaxed atomic store, so a reader
+ * doing an aligned 8 byte atomic load sees either the old value or the new
+ * one, never a mixture. Bytes at either end that don't make up a whole word
+ * are stored one at a time. A release fence at the end means that a reader
+ * that sees a later store by this thread (say, a generation counter bumped
+ * after the reset) also sees the whole fill. On x86-64 the relaxed stores are
+ * plain mov instructions, so this costs little over wordwise_unaligned_memset.
+ */
+void* atomic_fill(void* s, int c, size_t n) {
+    byte* p = (byte*)s;
+    byte* end = p + n;
+    byte xx = c & 0xff;
+    uint64_t x = (uint64_t)xx * 0x0101010101010101ULL;
+
+    for (; p < end && ((uintptr_t)p & 7); ++p)
+        __atomic_store_n(p, xx, __ATOMIC_RELAXED);
+    for (; end - p >= 32; p += 32) {
+        __atomic_store_n((uint64_t*)p, x, __ATOMIC_RELAXED);
+        __atomic_store_n((uint64_t*)(p + 8), x, __ATOMIC_RELAXED);
+        __atomic_store_n((uint64_t*)(p + 16), x, __ATOMIC_RELAXED);
+        __atomic_store_n((uint64_t*)(p + 24), x, __ATOMIC_RELAXED);
+    }
+    for (; end - p >= 8; p += 8)
+        __atomic_store_n((uint64_t*)p, x, __ATOMIC_RELAXED);
+    for (; p < end; ++p)
+        __atomic_store_n(p, xx, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return s;
+}
+
+/* The fastest memset is the one you don't do. A common pattern is a large
+ * scratch area that's reset between uses, where each use only touches a few
+ * pages of it. Resetting the whole thing wastes most of the time on pages that
+ * already hold the right value. Linux can tell us which pages have been written
+ * to: every page table entry has a "soft-dirty" bit, set when the page is
+ * written, that we can clear by writing 4 to /proc/self/clear_refs and read
+ * back from /proc/self/pagemap (bit 55 of each page's 64 bit entry). A tracked
+ * region uses this to reset only the pages written since its last reset.
+ *
+ * The catch is that clear_refs clears the bits for the whole process, which
+ * would lose track of pages written in other tracked regions. So before
+ * clearing we harvest the soft-dirty bits of every live region into a bitmap
+ * of pages it still needs to reset. Pages written in another region while a
+ * reset is in progress can still be missed, so don't reset one region while
+ * another is being written to. Kernels without CONFIG_MEM_SOFT_DIRTY never set
+ * the bit; we detect this and fall back to resetting everything.
+ */
+struct tracked_region {
+    byte* base;
+    size_t size;       /* A multiple of the page size. */
+    int c;
+    int tracking;      /* Whether soft-dirty bits work. */
+    uint64_t* pending; /* Pages to reset, one bit each. */
+    struct tracked_region* next;
+};
 
-    /* Use GCC's built-in memset to validate our checking function. */
-    CHECK(memset, 0);
-    CHECK(memset, 1);
-
-    /* Check our implementations. */
-    CHECK(bytewise_memset, 0);
-    CHECK(bytewise_memset, 1);
-    CHECK(wordwise_32_memset, 0);
-    CHECK(wordwise_memset, 0);
-    CHECK(wordwise_32_unaligned_memset, 0);
-    CHECK(wordwise_32_unaligned_memset, 1);
-    CHECK(wordwise_unaligned_memset, 0);
-    CHECK(wordwise_unaligned_memset, 1);
-    CHECK(duffs_device_memset, 0);
-    CHECK(duffs_device_memset, 1);
+#define PAGEMAP_SOFT_DIRTY (1ULL << 55)
 
+static pthread_mutex_t tracked_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct tracked_region* tracked_regions;
+static int pagemap_fd = -1;
+
+static int clear_soft_dirty(void) {
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    int ok = fd >= 0 && write(fd, "4", 1) == 1;
+
+    if (fd >= 0)
+        close(fd);
+    return ok ? 0 : -1;
+}
+
+/* Add the pages of r that are soft-dirty to its pending bitmap. */
+static int harvest(struct tracked_region* r) {
+    uint64_t entries[512];
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t first = (uintptr_t)r->base / page, npages = r->size / page, i, j, n;
+
+    for (i = 0; i < npages; i += n) {
+        n = npages - i < 512 ? npages - i : 512;
+        if (pread(pagemap_fd, entries, n * sizeof(entries[0]),
+                  (first + i) * sizeof(entries[0])) !=
+            (ssize_t)(n * sizeof(entries[0])))
+            return -1;
+        for (j = 0; j < n; ++j)
+            if (entries[j] & PAGEMAP_SOFT_DIRTY)
+                r->pending[(i + j) / 64] |= 1ULL << ((i + j) % 64);
+    }
     return 0;
 }
+
+/* Harvest every region, then clear the soft-dirty bits. Called with
+ * tracked_lock held.
+ */
+static int harvest_and_clear(void) {
+    struct tracked_region* r;
+
+    for (r = tracked_regions; r; r = r->next)
+        if (r->tracking && harvest(r))
+            return -1;
+    return clear_soft_dirty();
+}
+
+struct tracked_region* tracked_region_create(size_t size, int c) {
+    size_t page = sysconf(_SC_PAGESIZE), npages;
+    struct tracked_region* r = calloc(1, sizeof(*r));
+    uint64_t entry;
+
+    if (!r)
+        return NULL;
+    r->size = (size + page - 1) & ~(page - 1);
+    r->c = c;
+    npages = r->size / page;
+    r->base = mmap(NULL, r->size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    r->pending = calloc((npages + 63) / 64, sizeof(uint64_t));
+    if (r->base == MAP_FAILED || !r->pending) {
+        if (r->base != MAP_FAILED)
+            munmap(r->base, r->size);
+        free(r->pending);
+        free(r);
+        return NULL;
+    }
+    if (c & 0xff)
+        memset_bulk(r->base, c, r->size);
+
+    pthread_mutex_lock(&tracked_lock);
+    if (pagemap_fd < 0)
+        pagemap_fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+
+    /* Check soft-dirty tracking works by clearing the bits, writing to our
+     * first page and seeing whether its bit gets set.
+     */
+    if (pagemap_fd >= 0 && !harvest_and_clear()) {
+        *(volatile byte*)r->base = (byte)c;
+        r->tracking = pread(pagemap_fd, &entry, sizeof(entry),
+                            (uintptr_t)r->base / page * sizeof(entry)) ==
+                          sizeof(entry) && (entry & PAGEMAP_SOFT_DIRTY);
+    }
+    r->next = tracked_regions;
+    tracked_regions = r;
+    pthread_mutex_unlock(&tracked_lock);
+    return r;
+}
+
+void* tracked_region_base(const struct tracked_region* r) {
+    return r->base;
+}
+
+long tracked_region_reset(struct tracked_region* r) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t npages = r->size / page, i, run;
+    long reset = 0;
+
+    pthread_mutex_lock(&tracked_lock);
+    if (r->tracking && harvest(r))
+        r->tracking = 0;
+    if (!r->tracking) {
+        memset_bulk(r->base, r->c, r->size);
+        pthread_mutex_unlock(&tracked_lock);
+        return npages;
+    }
+
+    /* Reset runs of consecutive dirty pages with one call each. */
+    for (i = 0; i < npages; i += run) {
+        for (run = 0; i + run < npages &&
+             (r->pending[(i + run) / 64] & (1ULL << ((i + run) % 64))); ++run);
+        if (run) {
+            memset_bulk(r->base + i * page, r->c, run * page);
+            reset += run;
+        } else {
+            run = 1;
+        }
+    }
+
+    /* Our own writes have just made the pages dirty again, and clearing them
+     * will also clear other regions' bits, so harvest those first.
+     */
+    if (harvest_and_clear()) {
+        /* We can't trust the bits any more, so reset everything next time. */
+        r->tracking = 0;
+    }
+    memset(r->pending, 0, (npages + 63) / 64 * sizeof(uint64_t));
+    pthread_mutex_unlock(&tracked_lock);
+    return reset;
+}
+
+void tracked_region_destroy(struct tracked_region* r) {
+    struct tracked_region** p;
+
+    if (!r)
+        return;
+    pthread_mutex_lock(&tracked_lock);
+    for (p = &tracked_regions; *p; p = &(*p)->next)
+        if (*p == r) {
+            *p = r->next;
+            break;
+        }
+    pthread_mutex_unlock(&tracked_lock);
+    munmap(r->base, r->size);
+    free(r->pending);
+    free(r);
+}
+
+/* Going one step further, a reset needn't touch the memory at all. After
+ * madvise(MADV_DONTNEED) the kernel drops a private anonymous mapping's pages,
+ * and the next access to each page faults in a fresh one. Usually the fresh
+ * page is zeroed, which is fine if zero is what you wanted. For any other value
+ * we can register the region with userfaultfd, so that faults on missing pages
+ * are handed to a thread of ours instead. That thread fills a page with the
+ * region's current value (using memset_bulk) and has the kernel copy it into
+ * place. A reset is then a single madvise however large the region, and pages
+ * are only filled if and when they're used.
+ *
+ * userfaultfd may be unavailable (unprivileged use is often disabled by the
+ * vm.unprivileged_userfaultfd sysctl). Then resets to zero still use
+ * MADV_DONTNEED and resets to anything else fill the region eagerly.
+ */
+struct lazy_region {
+    byte* base;
+    size_t size;
+    int c;
+    int uffd;          /* -1 without userfaultfd. */
+    int stop[2];       /* A pipe to tell the fault handler to finish. */
+    pthread_t handler;
+    pthread_mutex_t lock;
+    byte* page;        /* A page of the handler's current fill value. */
+    int page_c;
+};
+
+static void* lazy_handler(void* arg) {
+    struct lazy_region* r = arg;
+    size_t page = sysconf(_SC_PAGESIZE);
+    struct pollfd fds[2];
+    struct uffd_msg msg;
+    struct uffdio_copy copy;
+    struct uffdio_zeropage zero;
+    uintptr_t addr;
+
+    fds[0].fd = r->uffd;
+    fds[0].events = POLLIN;
+    fds[1].fd = r->stop[0];
+    fds[1].events = POLLIN;
+    for (;;) {
+        if (poll(fds, 2, -1) < 0 && errno != EINTR)
+            break;
+        if (fds[1].revents)
+            break;
+        if (read(r->uffd, &msg, sizeof(msg)) != sizeof(msg) ||
+            msg.event != UFFD_EVENT_PAGEFAULT)
+            continue;
+        addr = msg.arg.pagefault.address & ~(uintptr_t)(page - 1);
+
+        /* Holding the lock means a reset can't change the value or drop
+         * pages while we're filling one. EEXIST means another fault on the
+         * same page beat us to it, which is fine.
+         */
+        pthread_mutex_lock(&r->lock);
+        if (!(r->c & 0xff)) {
+            zero.range.start = addr;
+            zero.range.len = page;
+            zero.mode = 0;
+            ioctl(r->uffd, UFFDIO_ZEROPAGE, &zero);
+        } else {
+            if (r->page_c != r->c) {
+                memset_bulk(r->page, r->c, page);
+                r->page_c = r->c;
+            }
+            copy.dst = addr;
+            copy.src = (uintptr_t)r->page;
+            copy.len = page;
+            copy.mode = 0;
+            ioctl(r->uffd, UFFDIO_COPY, &copy);
+        }
+        pthread_mutex_unlock(&r->lock);
+    }
+    return NULL;
+}
+
+/* Set up userfaultfd for r, returning -1 if we can't. */
+static int lazy_register(struct lazy_region* r) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    struct uffdio_api api;
+    struct uffdio_register reg;
+
+    r->uffd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    if (r->uffd < 0)
+        return -1;
+    api.api = UFFD_API;
+    api.features = 0;
+    reg.range.start = (uintptr_t)r->base;
+    reg.range.len = r->size;
+    reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+    r->page = mmap(NULL, page, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    r->page_c = -1;
+    if (r->page != MAP_FAILED && !ioctl(r->uffd, UFFDIO_API, &api) &&
+        !ioctl(r->uffd, UFFDIO_REGISTER, &reg) && !pipe(r->stop)) {
+        if (!pthread_create(&r->handler, NULL, lazy_handler, r))
+            return 0;
+        close(r->stop[0]);
+        close(r->stop[1]);
+    }
+    if (r->page != MAP_FAILED)
+        munmap(r->page, page);
+    close(r->uffd);
+    r->uffd = -1;
+    return -1;
+}
+
+struct lazy_region* lazy_region_create(size_t size, int c) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    struct lazy_region* r = calloc(1, sizeof(*r));
+
+    if (!r)
+        return NULL;
+    r->size = (size + page - 1) & ~(page - 1);
+    r->c = c & 0xff;
+    r->base = mmap(NULL, r->size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r->base == MAP_FAILED) {
+        free(r);
+        return NULL;
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    if (lazy_register(r) && r->c)
+        memset_bulk(r->base, r->c, r->size);
+    return r;
+}
+
+void* lazy_region_base(const struct lazy_region* r) {
+    return r->base;
+}
+
+int lazy_region_is_lazy(const struct lazy_region* r) {
+    return r->uffd >= 0;
+}
+
+int lazy_region_reset(struct lazy_region* r, int c) {
+    int ret = 0;
+
+    c &= 0xff;
+    pthread_mutex_lock(&r->lock);
+    if (r->uffd >= 0 || !c) {
+        r->c = c;
+        ret = madvise(r->base, r->size, MADV_DONTNEED);
+    }
+    if (r->uffd < 0 && (c || ret)) {
+        r->c = c;
+        memset_bulk(r->base, c, r->size);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&r->lock);
+    return ret;
+}
+
+void lazy_region_destroy(struct lazy_region* r) {
+    if (!r)
+        return;
+    if (r->uffd >= 0) {
+        if (write(r->stop[1], "", 1) == 1)
+            pthread_join(r->handler, NULL);
+        close(r->stop[0]);
+        close(r->stop[1]);
+        close(r->uffd);
+        munmap(r->page, sysconf(_SC_PAGESIZE));
+    }
+    pthread_mutex_destroy(&r->lock);
+    munmap(r->base, r->size);
+    free(r);
+}
+
+/* Zeroing a shared file mapping with stores dirties every page, and each of
+ * them then has to be written back. But the filesystem can zero a file range
+ * itself with fallocate, by marking the blocks unwritten (FALLOC_FL_ZERO_RANGE)
+ * or dropping them altogether (FALLOC_FL_PUNCH_HOLE), which also drops the
+ * pages from the page cache. Mapped pages read back as zero afterwards and
+ * there's nothing to write back beyond some metadata.
+ *
+ * We find the file behind an address in /proc/self/maps. The path there may
+ * since have been replaced by a different file, so we check that the device and
+ * inode match before trusting it.
+ */
+static int mapped_file(const void* s, size_t n, off_t* offset) {
+    char line[4096], perms[5];
+    unsigned long start, end, inode;
+    unsigned long long off;
+    unsigned int major, minor;
+    uintptr_t p = (uintptr_t)s;
+    struct stat st;
+    char* path;
+    int fd = -1, pos;
+    FILE* maps = fopen("/proc/self/maps", "r");
+
+    if (!maps)
+        return -1;
+    while (fgets(line, sizeof(line), maps)) {
+        if (sscanf(line, "%lx-%lx %4s %llx %x:%x %lu %n", &start, &end, perms,
+                   &off, &major, &minor, &inode, &pos) != 7)
+            continue;
+        if (p < start || p >= end)
+            continue;
+        /* Private mappings are copy on write, so the file isn't ours to
+         * change.
+         */
+        if (n > end - p || perms[3] != 's' || !inode || line[pos] != '/')
+            break;
+        path = line + pos;
+        path[strcspn(path, "\n")] = '\0';
+        fd = open(path, O_RDWR | O_CLOEXEC);
+        if (fd >= 0 && (fstat(fd, &st) || st.st_ino != inode ||
+                        major(st.st_dev) != major ||
+                        minor(st.st_dev) != minor)) {
+            close(fd);
+            fd = -1;
+        }
+        *offset = off + (p - start);
+        break;
+    }
+    fclose(maps);
+    return fd;
+}
+
+size_t zero_mapped_file_range(void* s, size_t n) {
+    byte* p = s;
+    size_t align = sysconf(_SC_PAGESIZE), head, tail;
+    off_t offset, lo, hi;
+    struct stat st;
+    int fd;
+
+    if (!n || (fd = mapped_file(s, n, &offset)) < 0) {
+        memset_bulk(s, 0, n);
+        return 0;
+    }
+
+    /* Only whole filesystem blocks can be zeroed this way, and only whole
+     * pages dropped from the mapping.
+     */
+    if (!fstat(fd, &st) && (size_t)st.st_blksize > align)
+        align = st.st_blksize;
+    lo = (offset + align - 1) / align * align;
+    hi = (offset + n) / align * align;
+    if (hi <= lo) {
+        close(fd);
+        memset_bulk(s, 0, n);
+        return 0;
+    }
+    head = lo - offset;
+    tail = offset + n - hi;
+    memset_bulk(p, 0, head);
+    memset_bulk(p + n - tail, 0, tail);
+    if (fallocate(fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE, lo, hi - lo) &&
+        fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, lo, hi - lo)) {
+        close(fd);
+        memset_bulk(p + head, 0, hi - lo);
+        return 0;
+    }
+    close(fd);
+    return hi - lo;
+}
+
+/* Filling a file mapping durably, say to preallocate a journal, is often
+ * done a block at a time with an msync after each. Every msync is a system call
+ * that walks the page tables and waits for I/O, so it's much better to fill
+ * the whole range and sync once. The data is only going to the file, so we
+ * fill it with non-temporal stores rather than pulling it all through the
+ * cache.
+ *
+ * On persistent memory mapped with DAX there's no page cache: the stores go
+ * to the medium itself, and they're durable once they've left the CPU caches.
+ * flush_lines asks us to fill through the cache and then write each line back
+ * with clwb (or clflushopt), which starts the write back as we go rather than
+ * leaving it all to msync. (There's no point doing that after non-temporal
+ * stores, which never reach the cache.) Without either instruction it's
+ * ignored.
+ */
+int durable_fill(void* s, int c, size_t n, int flush_lines) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)s & ~(uintptr_t)(page - 1);
+#if defined(__x86_64__) || defined(__i386__)
+    void (*flush)(byte*, byte*) = flush_lines ? line_flush() : NULL;
+#endif
+
+    if (!n)
+        return 0;
+    pthread_once(&dispatch_once, dispatch_init);
+#if defined(__x86_64__) || defined(__i386__)
+    if (flush) {
+        cached_fill(s, c, n);
+        flush((byte*)s, (byte*)s + n);
+    } else
+#endif
+    if (dispatch.nt_impl && n > 64)
+        dispatch.nt_impl(s, c, n);
+    else
+        cached_fill(s, c, n);
+    return msync((void*)start, (uintptr_t)s + n - start, MS_SYNC);
+}
+
+/* There's one situation where a plain memset doesn't do what you want. If you
+ * clear a buffer holding a key or password just before freeing it or returning,
+ * the compiler can see that nothing ever reads the zeros and is entitled to
+ * delete the memset entirely. People often work around this with a loop
+ * through a volatile pointer, which does the job but a byte at a time. Instead
+ * we call memset_bulk through a volatile function pointer, so the compiler
+ * can't know what it does and has to call it, and follow that with an empty
+ * assembly statement that claims to read memory, so the stores can't be
+ * considered dead even if the call is somehow inlined (e.g. with LTO).
+ */
+static void* (*volatile secure_memset_impl)(void*, int, size_t) = memset_bulk;
+
+void* secure_memset(void* s, int c, size_t n) {
+    secure_memset_impl(s, c, n);
+#ifdef __GNUC__
+    __asm__ __volatile__ ("" : : "r" (s) : "memory");
+#endif
+    return s;
+}
+
+/* Lines below here are instrumentation for testing your implementation. */
+
+/* memset_lines and clear_pages in the shape of memset, so that they can go in
+ * the table below. Their granularity keeps them to whole lines and pages.
+ * clear_pages can only clear, so pages_memset uses memset_lines for anything
+ * else.
+ */
+static void* lines_memset(void* s, int c, size_t n) {
+    memset_lines(s, n / LINE_SIZE, c);
+    return s;
+}
+
+static void* pages_memset(void* s, int c, size_t n) {
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    if (c & 0xff || n % page)
+        memset_lines(s, n / LINE_SIZE, c);
+    else
+        clear_pages(s, n / page);
+    return s;
+}
+
+/* The checks and benchmarks need to know which implementations there are and
+ * what each of them can cope with. The granularity is the alignment (of both
+ * the pointer and the size) that an implementation requires; the word-wise
+ * versions without a prologue and epilogue can only be handed whole, aligned
+ * words. Some implementations need processor features we have to check for
+ * before running them.
+ */
+struct kernel {
+    const char* name;
+    void* (*f)(void*, int, size_t);
+    size_t granularity;
+    int (*available)(void);  /* NULL if the implementation always works. */
+};
+
+static const struct kernel kernels[] = {
+    { "memset", memset, 1 },
+    { "bytewise_memset", bytewise_memset, 1 },
+    { "wordwise_32_memset", wordwise_32_memset, 4 },
+    { "wordwise_memset", wordwise_memset, sizeof(uintptr_t) },
+    { "wordwise_32_unaligned_memset", wordwise_32_unaligned_memset, 1 },
+    { "wordwise_unaligned_memset", wordwise_unaligned_memset, 1 },
+    { "duffs_device_memset", duffs_device_memset, 1 },
+    { "compact_memset", compact_memset, 1 },
+#if defined(__x86_64__) || defined(__i386__)
+    { "rep_stosb_memset", rep_stosb_memset, 1 },
+    { "sse2_memset", sse2_memset, 1 },
+    { "nt_memset", nt_memset, 1 },
+    { "avx2_memset", avx2_memset, 1, have_avx2 },
+#endif
+    { "fast_memset", fast_memset, 1 },
+    { "memset_bulk", memset_bulk, 1 },
+    { "secure_memset", secure_memset, 1 },
+    { "atomic_fill", atomic_fill, 1 },
+    { "lines_memset", lines_memset, LINE_SIZE },
+    { "pages_memset", pages_memset, 4096 },
+};
+
+#define KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static int available(const struct kernel* k) {
+    return !k->available || k->available();
+}
+
+/* The copy kernels take a source rather than a value, so they get a table of
+ * their own. overlap says whether they allow the ranges to overlap, as memmove
+ * does.
+ */
+struct copy_kernel {
+    const char* name;
+    void* (*f)(void*, const void*, size_t);
+    int overlap;
+    int (*available)(void);
+};
+
+static const struct copy_kernel copy_kernels[] = {
+    { "memcpy", memcpy, 0 },
+    { "memmove", memmove, 1 },
+    { "wordwise_memmove", wordwise_memmove, 1 },
+#if defined(__x86_64__) || defined(__i386__)
+    { "rep_movsb_memcpy", rep_movsb_memcpy, 0 },
+    { "sse2_memmove", sse2_memmove, 1 },
+    { "nt_memcpy", nt_memcpy, 0 },
+    { "avx2_memmove", avx2_memmove, 1, have_avx2 },
+#endif
+    { "fast_memcpy", fast_memcpy, 0 },
+    { "fast_memmove", fast_memmove, 1 },
+    { "memcpy_bulk", memcpy_bulk, 0 },
+    { "memmove_bulk", memmove_bulk, 1 },
+};
+
+#define COPY_KERNELS (sizeof(copy_kernels) / sizeof(copy_kernels[0]))
+
+/* Every implementation has fiddly code at its edges, and the faster ones are
+ * fiddlier: overlapping stores, stores rounded out to whole vectors. So we
+ * check each of them at every size from 0 to 2048 bytes (or to a few times
+ * their granularity, if that's coarser), at every offset from a 64 byte
+ * boundary and with several values, including one with bits set above the low
+ * byte, which memset has to ignore. The 64 bytes either side of each fill must
+ * be left alone. Each fill is done twice, once starting right after an
+ * inaccessible guard page and once ending as close to another as the offset
+ * allows, so that a stray access further out crashes rather than going
+ * unnoticed.
+ *
+ * That's millions of fills, so we spread them over a thread per CPU, each with
+ * its own guarded buffer. libc's memset is first in the table, which checks
+ * the checks.
+ */
+#define GUARD_MAX_SIZE 2048
+#define GUARD_SLACK 64
+#define GUARD_MAX_THREADS 64
+
+static const int guard_values[] = { 0, 0x7f, 0x80, -1, 0x15a };
+
+#define GUARD_VALUES (sizeof(guard_values) / sizeof(guard_values[0]))
+
+struct guard {
+    size_t len;               /* Of each buffer, between its guard pages. */
+    unsigned int next;        /* The next (kernel, value) pair to check. */
+    int error;
+    int failed[KERNELS];
+};
+
+/* What each thread is checking, for when it crashes. */
+static __thread struct {
+    const char* kernel;
+    size_t n, offset;
+    int c;
+    const char* where;
+} guard_current;
+
+static void guard_crashed(int sig) {
+    char msg[256];
+    int len;
+
+    len = snprintf(msg, sizeof(msg), "%s crashed (signal %d) with size %zu, "
+                   "offset %zu and value %#x %s the buffer.\n",
+                   guard_current.kernel, sig, guard_current.n,
+                   guard_current.offset, guard_current.c, guard_current.where);
+    if (len > 0 && write(STDOUT_FILENO, msg, len) < 0)
+        _exit(2);
+    _exit(1);
+}
+
+static size_t guard_max_size(const struct kernel* k) {
+    return k->granularity * 4 > GUARD_MAX_SIZE ? k->granularity * 4
+                                               : GUARD_MAX_SIZE;
+}
+
+/* Fill n bytes at p and check them and the bytes around them against the
+ * expected fill and canary bytes. On failure, returns -1 with the position of
+ * the first wrong byte, relative to p, in bad.
+ */
+static int guard_fill(const struct kernel* k, byte* data, size_t len, byte* p,
+                      size_t n, int c, const byte* fill, const byte* canary,
+                      long* bad) {
+    byte* lo = p - data > GUARD_SLACK ? p - GUARD_SLACK : data;
+    byte* hi = (size_t)(data + len - (p + n)) > GUARD_SLACK
+               ? p + n + GUARD_SLACK : data + len;
+    byte* q;
+
+    memset(lo, canary[0], hi - lo);
+    k->f(p, c, n);
+    if (!memcmp(lo, canary, p - lo) && !memcmp(p, fill, n) &&
+        !memcmp(p + n, canary, hi - (p + n)))
+        return 0;
+    for (q = lo; q < hi; ++q)
+        if (*q != (q >= p && q < p + n ? fill[0] : canary[0]))
+            break;
+    *bad = q - p;
+    return -1;
+}
+
+static void* guard_worker(void* arg) {
+    struct guard* g = arg;
+    size_t page = sysconf(_SC_PAGESIZE), n, offset, max, align;
+    const struct kernel* k;
+    unsigned int task;
+    uintptr_t x;
+    byte* map;
+    byte* data;
+    byte* fill = malloc(g->len);
+    byte* canary = malloc(g->len);
+    byte* p;
+    long bad;
+    int c, end;
+
+    map = mmap(NULL, g->len + 2 * page, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED || !fill || !canary ||
+        mprotect(map, page, PROT_NONE) ||
+        mprotect(map + page + g->len, page, PROT_NONE)) {
+        g->error = 1;
+        goto out;
+    }
+    data = map + page;
+
+    while ((task = __atomic_fetch_add(&g->next, 1, __ATOMIC_RELAXED)) <
+           KERNELS * GUARD_VALUES) {
+        k = &kernels[task / GUARD_VALUES];
+        c = guard_values[task % GUARD_VALUES];
+        if (!available(k))
+            continue;
+        memset(fill, c, g->len);
+        memset(canary, c ^ 0x5a, g->len);
+        max = guard_max_size(k);
+        align = k->granularity > 64 ? k->granularity : 64;
+        guard_current.kernel = k->name;
+        guard_current.c = c;
+        for (n = 0; n <= max; n += k->granularity)
+            for (offset = 0; offset < align; offset += align == 64 ?
+                                                      k->granularity : align)
+                for (end = 0; end < 2; ++end) {
+                    if (__atomic_load_n(&g->failed[task / GUARD_VALUES],
+                                        __ATOMIC_RELAXED))
+                        goto next;
+                    x = (uintptr_t)(data + g->len - n);
+                    p = end ? (byte*)(x - ((x - offset) & (align - 1)))
+                            : data + offset;
+                    guard_current.n = n;
+                    guard_current.offset = offset;
+                    guard_current.where = end ? "at the end of"
+                                              : "at the start of";
+                    if (guard_fill(k, data, g->len, p, n, c, fill, canary,
+                                   &bad)) {
+                        __atomic_store_n(&g->failed[task / GUARD_VALUES], 1,
+                                         __ATOMIC_RELAXED);
+                        printf("%s check failed with size %zu, offset %zu "
+                               "and value %#x %s the buffer on byte %ld.\n",
+                               k->name, n, offset, c, guard_current.where,
+                               bad);
+                    }
+                }
+next:
+        ;
+    }
+out:
+    if (map != MAP_FAILED)
+        munmap(map, g->len + 2 * page);
+    free(fill);
+    free(canary);
+    return NULL;
+}
+
+/* Check every implementation in the table, returning -1 if any failed. */
+static int check_kernels(void) {
+    static struct guard g;
+    pthread_t threads[GUARD_MAX_THREADS];
+    struct sigaction sa, old_segv, old_bus;
+    size_t page = sysconf(_SC_PAGESIZE), max = 0;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads, i;
+    unsigned int k;
+
+    for (k = 0; k < KERNELS; ++k)
+        if (guard_max_size(&kernels[k]) > max)
+            max = guard_max_size(&kernels[k]);
+    g.len = (max + 64 + 2 * GUARD_SLACK + page - 1) / page * page;
+
+    sa.sa_handler = guard_crashed;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(SIGSEGV, &sa, &old_segv);
+    sigaction(SIGBUS, &sa, &old_bus);
+
+    nthreads = ncpus < 1 ? 1 : ncpus > GUARD_MAX_THREADS ? GUARD_MAX_THREADS
+                                                        : ncpus;
+    for (i = 0; i < nthreads; ++i)
+        if (pthread_create(&threads[i], NULL, guard_worker, &g))
+            break;
+    if (!i)
+        guard_worker(&g);
+    while (i--)
+        pthread_join(threads[i], NULL);
+
+    sigaction(SIGSEGV, &old_segv, NULL);
+    sigaction(SIGBUS, &old_bus, NULL);
+    if (g.error) {
+        fprintf(stderr, "couldn't set up guarded buffers\n");
+        return -1;
+    }
+    for (k = 0; k < KERNELS; ++k)
+        if (g.failed[k])
+            return -1;
+    return 0;
+}
+
+/* memcpy_pad has two sizes to get right, so it gets a check of its own: every
+ * combination of data and padding up to a little over the inline limits, with
+ * the bytes either side of the record left alone.
+ */
+static int check_memcpy_pad(void) {
+    byte src[80], buffer[96] __attribute__((aligned(64)));
+    size_t n, total, off, i;
+
+    for (i = 0; i < sizeof(src); ++i)
+        src[i] = (byte)(i * 7 + 1);
+    for (off = 0; off < 8; ++off)
+        for (total = 0; total <= sizeof(src); ++total)
+            for (n = 0; n <= total; ++n) {
+                for (i = 0; i < sizeof(buffer); ++i)
+                    buffer[i] = 0xee;
+                memcpy_pad(buffer + off, src, n, total, 0xa5);
+                for (i = 0; i < sizeof(buffer); ++i)
+                    if (buffer[i] != (i < off || i >= off + total ? 0xee
+                                      : i < off + n ? src[i - off] : 0xa5)) {
+                        printf("memcpy_pad check failed with n = %zu, total = "
+                               "%zu on byte %zu.\n", n, total, i);
+                        return -1;
+                    }
+            }
+    return 0;
+}
+
+/* Check a copy kernel at every size up to a little past where the loops take
+ * over, between every pair of offsets a vector could care about, and check
+ * that it leaves the bytes around the destination alone. Kernels that allow
+ * overlap are also checked with the source a little either side of the
+ * destination in the same buffer.
+ */
+static int check_copy(const struct copy_kernel* k) {
+    static byte src[1024] __attribute__((aligned(64)));
+    static byte dst[1024] __attribute__((aligned(64)));
+    static byte want[1024];
+    size_t n, i, doff, soff;
+    int delta;
+
+    for (i = 0; i < sizeof(src); ++i)
+        src[i] = (byte)(i * 7 + 1);
+    for (n = 0; n <= 520; ++n)
+        for (doff = 0; doff < 32; ++doff)
+            for (soff = 0; soff < 4; ++soff) {
+                for (i = 0; i < sizeof(dst); ++i)
+                    dst[i] = 0xee;
+                k->f(dst + doff, src + soff, n);
+                for (i = 0; i < sizeof(dst); ++i)
+                    if (dst[i] != (i < doff || i >= doff + n ? 0xee
+                                   : src[i - doff + soff])) {
+                        printf("%s check failed with size %zu, offsets %zu "
+                               "and %zu on byte %zu.\n", k->name, n, doff,
+                               soff, i);
+                        return -1;
+                    }
+            }
+    if (!k->overlap)
+        return 0;
+    for (n = 0; n <= 300; ++n)
+        for (delta = -80; delta <= 80; ++delta) {
+            for (i = 0; i < sizeof(dst); ++i)
+                want[i] = dst[i] = src[i];
+            for (i = 0; i < n; ++i)
+                want[256 + i] = src[256 + delta + i];
+            k->f(dst + 256, dst + 256 + delta, n);
+            for (i = 0; i < sizeof(dst); ++i)
+                if (dst[i] != want[i]) {
+                    printf("%s check failed with size %zu, source %+d on "
+                           "byte %zu.\n", k->name, n, delta, i);
+                    return -1;
+                }
+        }
+    return 0;
+}
+
+/* The regions above are only worth having if a reset really does leave every
+ * byte holding the value, including bytes in pages that were written and then
+ * dropped or skipped.
+ */
+#define CHECK_REGION_PAGES 64
+
+static int check_filled(const char* what, const byte* p, int c, size_t n) {
+    size_t i;
+
+    for (i = 0; i < n && p[i] == (byte)c; ++i);
+    if (i == n)
+        return 0;
+    printf("%s check failed with value %#x on byte %zu.\n", what, c & 0xff,
+           i);
+    return -1;
+}
+
+/* Scribble over a scattered set of pages, with some writes running on into
+ * the next page. Which pages depends on the round.
+ */
+static void scribble(byte* p, size_t npages, int round, int c) {
+    size_t page = sysconf(_SC_PAGESIZE), i, j, at;
+
+    for (i = round % 3; i < npages; i += 3 + round) {
+        at = i * page + (i * 97 + round * 31) % page;
+        for (j = 0; j < 200 && at + j < npages * page; ++j)
+            p[at + j] = (byte)~c;
+    }
+}
+
+/* Tracked regions only reset the pages written since the last reset, so a
+ * page the tracking misses keeps whatever was written to it. With two live
+ * regions, resetting one clears the soft-dirty bits of the other, so its
+ * writes have to be harvested first; we alternate which is reset first.
+ * Without soft-dirty tracking only full resets are checked, and we say so, as
+ * the interesting part went unchecked.
+ */
+static int check_tracked_regions(void) {
+    static const int values[2] = { 0x5a, 0 };
+    size_t size = CHECK_REGION_PAGES * sysconf(_SC_PAGESIZE);
+    struct tracked_region* r[2];
+    int round, i, j, failed = 0;
+
+    r[0] = tracked_region_create(size, values[0]);
+    r[1] = tracked_region_create(size, values[1]);
+    if (!r[0] || !r[1]) {
+        printf("couldn't create tracked regions\n");
+        failed = 1;
+    }
+    for (round = 0; !failed && round < 6; ++round) {
+        for (j = 0; j < 2; ++j)
+            scribble(tracked_region_base(r[j]), CHECK_REGION_PAGES, round + j,
+                     values[j]);
+        for (i = 0; i < 2 && !failed; ++i) {
+            j = (i + round) & 1;
+            tracked_region_reset(r[j]);
+            failed = check_filled("tracked_region_reset",
+                                  tracked_region_base(r[j]), values[j],
+                                  size) != 0;
+        }
+    }
+    if (!failed && (!r[0]->tracking || !r[1]->tracking))
+        printf("soft-dirty tracking unavailable; only checked tracked regions' "
+               "full resets\n");
+    tracked_region_destroy(r[0]);
+    tracked_region_destroy(r[1]);
+    return failed ? -1 : 0;
+}
+
+/* Lazy regions fill pages as they're faulted in, with the value of the latest
+ * reset, so we check a fresh region, then reset to a new value after each
+ * round of writes. Two regions are live at once, each with its own handler.
+ */
+static int check_lazy_regions(void) {
+    static const int values[] = { 0, 0x5a, 0xa5, 0x17f, 0 };
+    size_t size = CHECK_REGION_PAGES * sysconf(_SC_PAGESIZE);
+    struct lazy_region* r[2];
+    int round, c, j, failed = 0;
+
+    r[0] = lazy_region_create(size, values[1]);
+    r[1] = lazy_region_create(size, values[0]);
+    if (!r[0] || !r[1]) {
+        printf("couldn't create lazy regions\n");
+        failed = 1;
+    }
+    for (j = 0; j < 2 && !failed; ++j)
+        failed = check_filled("lazy_region_create", lazy_region_base(r[j]),
+                              values[1 - j], size) != 0;
+    for (round = 0; !failed && round < 5; ++round)
+        for (j = 0; j < 2 && !failed; ++j) {
+            c = values[(round + j + 1) % 5];
+            scribble(lazy_region_base(r[j]), CHECK_REGION_PAGES, round + j, c);
+            if (lazy_region_reset(r[j], c)) {
+                printf("lazy_region_reset failed\n");
+                failed = 1;
+            } else {
+                failed = check_filled("lazy_region_reset",
+                                      lazy_region_base(r[j]), c, size) != 0;
+            }
+        }
+    lazy_region_destroy(r[0]);
+    lazy_region_destroy(r[1]);
+    return failed ? -1 : 0;
+}
+
+/* zero_mapped_file_range has to split each range into whole blocks for
+ * fallocate and ragged ends for stores, so we try ranges starting and ending
+ * either side of block boundaries in a file in /dev/shm, checking the zeroes,
+ * the bytes either side and how much it says went to fallocate. If the
+ * filesystem can't punch holes, everything should be done with stores. Memory
+ * that isn't a file mapping is zeroed with stores too.
+ */
+static int check_zero_mapped_file_range(void) {
+    static const size_t starts[] = { 0, 1, 4095, 4096, 4219, 12283 };
+    static const size_t lens[] = { 0, 1, 100, 4096, 4097, 8191, 12288, 20557 };
+    size_t page = sysconf(_SC_PAGESIZE), size = 16 * page, align = page;
+    size_t i, j, n, got, want;
+    off_t lo, hi;
+    char path[] = "/dev/shm/memset-check.XXXXXX";
+    byte buffer[300];
+    struct stat st;
+    byte* p;
+    int fd, punch, failed = 0;
+
+    for (i = 0; i < sizeof(buffer); ++i)
+        buffer[i] = 0xa5;
+    if (zero_mapped_file_range(buffer + 7, 250) ||
+        check_filled("zero_mapped_file_range", buffer + 7, 0, 250) ||
+        check_filled("zero_mapped_file_range", buffer, 0xa5, 7) ||
+        check_filled("zero_mapped_file_range", buffer + 257, 0xa5, 43)) {
+        printf("zero_mapped_file_range check failed on anonymous memory.\n");
+        return -1;
+    }
+
+    /* Without /dev/shm there's nothing to check. The file has to keep its
+     * name while it's mapped, as zero_mapped_file_range opens it by name.
+     */
+    if ((fd = mkstemp(path)) < 0)
+        return 0;
+    if (ftruncate(fd, size) ||
+        (p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) ==
+        MAP_FAILED) {
+        unlink(path);
+        close(fd);
+        return 0;
+    }
+    if (!fstat(fd, &st) && (size_t)st.st_blksize > align)
+        align = st.st_blksize;
+    punch = !fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0,
+                       align);
+
+    for (i = 0; i < sizeof(starts) / sizeof(starts[0]) && !failed; ++i)
+        for (j = 0; j < sizeof(lens) / sizeof(lens[0]) && !failed; ++j) {
+            n = starts[i] + lens[j] > size ? size - starts[i] : lens[j];
+            lo = (starts[i] + align - 1) / align * align;
+            hi = (starts[i] + n) / align * align;
+            want = punch && n && hi > lo ? hi - lo : 0;
+            memset_bulk(p, 0xa5, size);
+            got = zero_mapped_file_range(p + starts[i], n);
+            if (got != want ||
+                check_filled("zero_mapped_file_range", p + starts[i], 0, n) ||
+                check_filled("zero_mapped_file_range", p, 0xa5, starts[i]) ||
+                check_filled("zero_mapped_file_range", p + starts[i] + n,
+                             0xa5, size - starts[i] - n)) {
+                printf("zero_mapped_file_range check failed with offset %zu "
+                       "and size %zu, returning %zu for %zu.\n", starts[i], n,
+                       got, want);
+                failed = 1;
+            }
+        }
+    munmap(p, size);
+    unlink(path);
+    close(fd);
+    return failed ? -1 : 0;
+}
+
+/* memset_ex takes different paths depending on its hints and the size: the
+ * plain vector loop, non-temporal stores, a split across threads from 8 MiB
+ * and handing whole pages back to the kernel from 1 MiB, with stores at the
+ * ragged ends. So we try every combination of hints on fills from small to
+ * over 8 MiB, starting and ending part way through a page, in a private
+ * anonymous mapping so that pages can be released, with bytes either side
+ * that must be left alone.
+ */
+#define EX_SLACK 64
+
+static int check_memset_ex(void) {
+    static const size_t sizes[] = { 65, 4099, (1 << 20) + 12289,
+                                    (9 << 20) - 4100 };
+    static const size_t offsets[] = { 1, 4093 };
+    static const int values[] = { 0, 0x15a };
+    size_t page = sysconf(_SC_PAGESIZE), len = (9 << 20) + 2 * page;
+    size_t i, j, n, off;
+    unsigned flags;
+    unsigned int v;
+    byte* p;
+    int failed = 0;
+
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+             -1, 0);
+    if (p == MAP_FAILED) {
+        printf("couldn't map a buffer for memset_ex\n");
+        return -1;
+    }
+    for (flags = 0; flags < 32 && !failed; ++flags)
+        for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && !failed; ++i)
+            for (j = 0; j < sizeof(offsets) / sizeof(offsets[0]) && !failed;
+                 ++j)
+                for (v = 0; v < sizeof(values) / sizeof(values[0]) &&
+                     !failed; ++v) {
+                    n = sizes[i];
+                    off = offsets[j] + EX_SLACK;
+                    memset(p + off - EX_SLACK, 0xee, n + 2 * EX_SLACK);
+                    memset_ex(p + off, values[v], n, flags);
+                    if (check_filled("memset_ex", p + off, values[v], n) ||
+                        check_filled("memset_ex", p + off - EX_SLACK, 0xee,
+                                     EX_SLACK) ||
+                        check_filled("memset_ex", p + off + n, 0xee,
+                                     EX_SLACK)) {
+                        printf("memset_ex check failed with flags %#x, size "
+                               "%zu and offset %zu.\n", flags, n, off);
+                        failed = 1;
+                    }
+                }
+    munmap(p, len);
+    return failed ? -1 : 0;
+}
+
+/* Wall clock time in seconds. */
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Parse a size given on the command line, accepting the usual K, M and G
+ * suffixes (powers of 1024). Returns 0 on malformed input.
+ */
+static size_t parse_size(const char* s) {
+    char* end;
+    unsigned long long n = strtoull(s, &end, 0);
+
+    switch (*end) {
+        case 'k': case 'K': n <<= 10; ++end; break;
+        case 'm': case 'M': n <<= 20; ++end; break;
+        case 'g': case 'G': n <<= 30; ++end; break;
+    }
+    return *end ? 0 : (size_t)n;
+}
+
+/* Parse a CPU list in the format sysfs uses (e.g. "0-3,8,10-11") into a CPU
+ * set. Returns the number of CPUs in the list, or -1 if it was malformed.
+ */
+static int parse_cpulist(const char* s, cpu_set_t* set) {
+    char* end;
+    long lo, hi;
+
+    CPU_ZERO(set);
+    while (*s && *s != '\n') {
+        lo = hi = strtol(s, &end, 10);
+        if (end == s)
+            return -1;
+        if (*end == '-')
+            hi = strtol(end + 1, &end, 10);
+        if (lo < 0 || hi < lo || hi >= CPU_SETSIZE)
+            return -1;
+        for (; lo <= hi; ++lo)
+            CPU_SET(lo, set);
+        s = *end == ',' ? end + 1 : end;
+    }
+    return CPU_COUNT(set);
+}
+
+/* Read a CPU list out of a sysfs file. Returns the number of CPUs read, or -1
+ * if the file does not exist or is malformed.
+ */
+static int read_cpulist(const char* path, cpu_set_t* set) {
+    char buffer[1024];
+    FILE* f = fopen(path, "r");
+    int ok;
+
+    if (!f)
+        return -1;
+    ok = fgets(buffer, sizeof(buffer), f) != NULL;
+    fclose(f);
+    if (!ok)
+        return -1;
+    return parse_cpulist(buffer, set);
+}
+
+/* Pin the calling thread to a single CPU. */
+static int pin_to_cpu(int cpu) {
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+/* Return the lowest numbered CPU we are allowed to run on other than the one
+ * given, preferring one that shares a last level cache with it. Returns -1 if
+ * we only have one CPU.
+ */
+static int llc_sibling(int cpu) {
+    char path[128];
+    cpu_set_t allowed, shared;
+    int i;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed))
+        return -1;
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/cpu/cpu%d/cache/index3/shared_cpu_list", cpu);
+    if (read_cpulist(path, &shared) > 0)
+        for (i = 0; i < CPU_SETSIZE; ++i)
+            if (i != cpu && CPU_ISSET(i, &shared) && CPU_ISSET(i, &allowed))
+                return i;
+    for (i = 0; i < CPU_SETSIZE; ++i)
+        if (i != cpu && CPU_ISSET(i, &allowed))
+            return i;
+    return -1;
+}
+
+/* A cheap, reproducible pseudo-random number generator and a mixing function
+ * for turning counters into well-spread keys.
+ */
+static uint64_t xorshift64(uint64_t* state) {
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static uint64_t mix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/* Raw throughput doesn't tell you how much damage a memset does to everything
+ * else running on the machine. A kernel that streams through the cache evicts
+ * its neighbours' working sets, and they pay for it later. To measure this we
+ * run a reader doing lookups in a fixed size hash table on one CPU, and fill a
+ * large buffer with each implementation on another CPU sharing the last level
+ * cache. The reader's slowdown relative to running on its own is the cost the
+ * implementation imposes on its neighbours. With -C the writer copies into the
+ * buffer from another of the same size instead, with each copy kernel.
+ */
+struct reader {
+    uint64_t* table; /* Key/value pairs, open addressed, half full. */
+    size_t slots;
+    int cpu;
+    int stop;
+    double lookups_per_sec;
+    uint64_t sink;
+};
+
+struct writer {
+    const struct kernel* k;        /* At most one of these is set. */
+    const struct copy_kernel* ck;
+    byte* buffer;
+    byte* source;
+    size_t len;
+    int cpu;
+    int stop;
+    double bytes_per_sec;
+};
+
+static void* reader_main(void* arg) {
+    struct reader* r = arg;
+    uint64_t state = 88172645463325252ULL;
+    uint64_t sum = 0, lookups = 0, key;
+    size_t mask = r->slots - 1, slot;
+    double start;
+    int i;
+
+    pin_to_cpu(r->cpu);
+    start = now();
+    while (!__atomic_load_n(&r->stop, __ATOMIC_RELAXED)) {
+        for (i = 0; i < 1024; ++i) {
+            key = mix64(xorshift64(&state) & (mask >> 1));
+            for (slot = key & mask; r->table[2*slot] != key;
+                 slot = (slot + 1) & mask);
+            sum += r->table[2*slot + 1];
+        }
+        lookups += 1024;
+    }
+    r->lookups_per_sec = lookups / (now() - start);
+    r->sink = sum;
+    return NULL;
+}
+
+static void* writer_main(void* arg) {
+    struct writer* w = arg;
+    uint64_t bytes = 0;
+    double start;
+    int c = 0;
+
+    pin_to_cpu(w->cpu);
+    start = now();
+    while (!__atomic_load_n(&w->stop, __ATOMIC_RELAXED)) {
+        if (w->ck)
+            w->ck->f(w->buffer, w->source, w->len);
+        else
+            w->k->f(w->buffer, c++, w->len);
+        bytes += w->len;
+    }
+    w->bytes_per_sec = bytes / (now() - start);
+    return NULL;
+}
+
+/* Run the reader for the given duration, alongside the writer if it has a
+ * kernel.
+ */
+static int interfere(struct reader* r, struct writer* w, double seconds) {
+    int writing = w->k || w->ck;
+    pthread_t rt, wt;
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)seconds;
+    ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+    r->stop = w->stop = 0;
+    if (pthread_create(&rt, NULL, reader_main, r))
+        return -1;
+    if (writing && pthread_create(&wt, NULL, writer_main, w)) {
+        __atomic_store_n(&r->stop, 1, __ATOMIC_RELAXED);
+        pthread_join(rt, NULL);
+        return -1;
+    }
+    nanosleep(&ts, NULL);
+    __atomic_store_n(&r->stop, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->stop, 1, __ATOMIC_RELAXED);
+    pthread_join(rt, NULL);
+    if (writing)
+        pthread_join(wt, NULL);
+    return 0;
+}
+
+static int interference_main(int argc, char** argv) {
+    struct reader r;
+    struct writer w;
+    size_t working_set = 4 << 20, i, key;
+    double seconds = 1, baseline;
+    const char* name;
+    unsigned int j;
+    int opt, copies = 0;
+
+    w.len = 256 << 20;
+    w.source = NULL;
+    r.cpu = w.cpu = -1;
+    while ((opt = getopt(argc, argv, "r:w:s:f:t:C")) != -1) {
+        switch (opt) {
+            case 'r': r.cpu = atoi(optarg); break;
+            case 'w': w.cpu = atoi(optarg); break;
+            case 's': working_set = parse_size(optarg); break;
+            case 'f': w.len = parse_size(optarg); break;
+            case 't': seconds = atof(optarg); break;
+            case 'C': copies = 1; break;
+            default: return 2;
+        }
+    }
+    if (working_set < 64 || (working_set & (working_set - 1))) {
+        fprintf(stderr, "working set must be a power of 2 of at least 64 bytes\n");
+        return 2;
+    }
+    w.len &= ~(size_t)63;
+    if (!w.len || seconds <= 0) {
+        fprintf(stderr, "fill size and duration must be positive\n");
+        return 2;
+    }
+
+    if (r.cpu < 0)
+        r.cpu = sched_getcpu();
+    if (w.cpu < 0)
+        w.cpu = llc_sibling(r.cpu);
+    if (w.cpu < 0) {
+        fprintf(stderr, "warning: only one CPU available; the reader and "
+                        "writer will time-share it\n");
+        w.cpu = r.cpu;
+    }
+
+    r.slots = working_set / (2 * sizeof(uint64_t));
+    if (posix_memalign((void**)&r.table, 64, working_set) ||
+        posix_memalign((void**)&w.buffer, 64, w.len) ||
+        (copies && posix_memalign((void**)&w.source, 64, w.len))) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    memset(r.table, 0, working_set);
+    memset(w.buffer, 0, w.len);
+    if (copies)
+        memset(w.source, 0x5a, w.len);
+    for (i = 0; i < r.slots / 2; ++i) {
+        key = mix64(i);
+        for (j = key & (r.slots - 1); r.table[2*j];
+             j = (j + 1) & (r.slots - 1));
+        r.table[2*j] = key;
+        r.table[2*j + 1] = i;
+    }
+
+    printf("reader: %zu KiB hash table on CPU %d\n", working_set >> 10, r.cpu);
+    printf("writer: %zu MiB %s on CPU %d, %.1f s per run\n\n", w.len >> 20,
+           copies ? "copies" : "fills", w.cpu, seconds);
+
+    w.k = NULL;
+    w.ck = NULL;
+    if (interfere(&r, &w, seconds))
+        return 1;
+    baseline = r.lookups_per_sec;
+    printf("%-30s %12s %18s %10s\n", "kernel", "writer GB/s",
+           "reader Mlookups/s", "slowdown");
+    printf("%-30s %12s %18.2f %10s\n", "(none)", "-", baseline / 1e6, "-");
+    for (j = 0; j < (copies ? COPY_KERNELS : KERNELS); ++j) {
+        if (copies) {
+            if (copy_kernels[j].available && !copy_kernels[j].available())
+                continue;
+            w.ck = &copy_kernels[j];
+            name = w.ck->name;
+        } else {
+            if (!available(&kernels[j]))
+                continue;
+            w.k = &kernels[j];
+            name = w.k->name;
+        }
+        if (interfere(&r, &w, seconds))
+            return 1;
+        printf("%-30s %12.2f %18.2f %9.1f%%\n", name, w.bytes_per_sec / 1e9,
+               r.lookups_per_sec / 1e6,
+               100 * (baseline / r.lookups_per_sec - 1));
+    }
+
+    free(r.table);
+    free(w.buffer);
+    free(w.source);
+    return 0;
+}
+
+/* Timing a single call to a memset is meaningless, and even a tight loop of
+ * calls is at the mercy of frequency scaling, interrupts and whatever else the
+ * machine is doing. The general benchmark below tries to give numbers you can
+ * actually base a decision on. It pins itself to a CPU (an isolated one, if the
+ * kernel was booted with isolcpus), spins until the clock frequency settles,
+ * then runs many trials of each measurement. Outliers are discarded using
+ * Tukey's fences and we report the median along with a distribution-free 95%
+ * confidence interval for it. Measurements whose coefficient of variation is
+ * above a threshold are flagged, as their confidence intervals are probably too
+ * wide to distinguish implementations a few percent apart.
+ */
+struct bench_options {
+    int cpu;
+    int trials;
+    double min_trial;  /* Minimum duration of a trial in seconds. */
+    double max_cv;     /* Flag results with a coefficient of variation above
+                          this. */
+};
+
+struct summary {
+    double median;
+    double lo, hi;     /* 95% confidence interval for the median. */
+    double cv;
+    int kept, rejected;
+};
+
+/* Time reps calls of op in seconds per call. */
+static double time_reps(void (*op)(void*), void* arg, unsigned long reps) {
+    unsigned long i;
+    double start = now();
+
+    for (i = 0; i < reps; ++i)
+        op(arg);
+    return (now() - start) / reps;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Summarise a set of samples. Note that this sorts and then compacts samples
+ * in place.
+ */
+static void summarise(double* samples, int n, struct summary* s) {
+    double q1, q3, iqr, mean = 0, var = 0;
+    int i, kept = 0, lo, hi;
+
+    qsort(samples, n, sizeof(samples[0]), compare_doubles);
+    q1 = samples[n / 4];
+    q3 = samples[(3 * n) / 4];
+    iqr = q3 - q1;
+    for (i = 0; i < n; ++i)
+        if (samples[i] >= q1 - 1.5 * iqr && samples[i] <= q3 + 1.5 * iqr)
+            samples[kept++] = samples[i];
+    s->kept = kept;
+    s->rejected = n - kept;
+
+    s->median = kept & 1 ? samples[kept / 2]
+                         : (samples[kept / 2 - 1] + samples[kept / 2]) / 2;
+
+    /* The number of samples below the median is binomially distributed, so
+     * the order statistics roughly 1.96 * sqrt(n) / 2 either side of the middle
+     * bound a 95% confidence interval for it.
+     */
+    lo = (int)floor(kept / 2.0 - 0.98 * sqrt(kept));
+    hi = (int)ceil(kept / 2.0 + 0.98 * sqrt(kept));
+    s->lo = samples[lo < 0 ? 0 : lo];
+    s->hi = samples[hi >= kept ? kept - 1 : hi];
+
+    for (i = 0; i < kept; ++i)
+        mean += samples[i];
+    mean /= kept;
+    for (i = 0; i < kept; ++i)
+        var += (samples[i] - mean) * (samples[i] - mean);
+    s->cv = kept > 1 ? sqrt(var / (kept - 1)) / mean : 0;
+}
+
+/* Measure op, returning a summary of its time per call in seconds. Returns -1
+ * if we ran out of memory.
+ */
+static int measure(void (*op)(void*), void* arg, const struct bench_options* o,
+                   struct summary* s) {
+    double* samples = malloc(o->trials * sizeof(double));
+    unsigned long reps;
+    int i;
+
+    if (!samples)
+        return -1;
+
+    /* Work out how many calls make up a trial of the requested length. This
+     * doubles as warming up the caches and TLB for this particular call.
+     */
+    for (reps = 1; time_reps(op, arg, reps) * reps < o->min_trial; reps *= 2);
+
+    for (i = 0; i < o->trials; ++i)
+        samples[i] = time_reps(op, arg, reps);
+    summarise(samples, o->trials, s);
+    free(samples);
+    return 0;
+}
+
+/* Spin until the CPU's clock frequency has settled, which we judge by a fixed
+ * amount of work taking the same time (within 1%) three times in a row. Gives
+ * up after a couple of seconds on machines that never settle.
+ */
+static double warm_up(void) {
+    volatile uint64_t x = 0;
+    double start = now(), last = 0, t;
+    int stable = 0;
+    uint64_t i;
+
+    while (stable < 3 && now() - start < 2) {
+        t = now();
+        for (i = 0; i < 10000000; ++i)
+            x += i;
+        t = now() - t;
+        stable = fabs(t - last) < 0.01 * t ? stable + 1 : 0;
+        last = t;
+    }
+    return now() - start;
+}
+
+/* Choose a CPU to pin to. Prefer an isolated CPU if there is one we are allowed
+ * to run on, otherwise just stay where we are.
+ */
+static int choose_cpu(int* isolated) {
+    cpu_set_t allowed, set;
+    int i;
+
+    *isolated = 0;
+    if (!sched_getaffinity(0, sizeof(allowed), &allowed) &&
+        read_cpulist("/sys/devices/system/cpu/isolated", &set) > 0)
+        for (i = 0; i < CPU_SETSIZE; ++i)
+            if (CPU_ISSET(i, &set) && CPU_ISSET(i, &allowed)) {
+                *isolated = 1;
+                return i;
+            }
+    return sched_getcpu();
+}
+
+/* The start of every benchmark: pin to o->cpu, choosing one if it's negative,
+ * say where we are and warm up. Returns -1 if we couldn't pin.
+ */
+static int bench_start(struct bench_options* o) {
+    int isolated = 0;
+
+    if (o->cpu < 0)
+        o->cpu = choose_cpu(&isolated);
+    if (pin_to_cpu(o->cpu)) {
+        perror("sched_setaffinity");
+        return -1;
+    }
+    printf("pinned to CPU %d%s\n", o->cpu,
+           isolated ? " (isolated)" : " (not isolated; expect noise)");
+    printf("warmed up in %.2f s\n", warm_up());
+    return 0;
+}
+
+/* Parse a comma separated list of sizes. Returns the number parsed or -1. */
+static int parse_sizes(char* s, size_t* sizes, int max) {
+    char* tok;
+    int n = 0;
+
+    for (tok = strtok(s, ","); tok; tok = strtok(NULL, ",")) {
+        if (n == max || (!(sizes[n] = parse_size(tok)) && strcmp(tok, "0")))
+            return -1;
+        ++n;
+    }
+    return n;
+}
+
+struct fill {
+    const struct kernel* k;
+    byte* p;
+    size_t len;
+};
+
+static void run_fill(void* arg) {
+    struct fill* f = arg;
+
+    f->k->f(f->p, 0x5a, f->len);
+}
+
+struct copy {
+    const struct copy_kernel* k;
+    byte* dst;
+    const byte* src;
+    size_t len;
+};
+
+static void run_copy(void* arg) {
+    struct copy* c = arg;
+
+    c->k->f(c->dst, c->src, c->len);
+}
+
+/* A benchmark run can be saved as a named baseline and a later run compared
+ * against it, so we notice when a change to an implementation (or to the
+ * compiler) makes it slower. Baselines are JSON with one result per line. We
+ * only ever need to read back what we wrote, so the reader below is no more
+ * general than that.
+ */
+struct result {
+    char kernel[64];
+    size_t size, align;
+    double median, lo, hi;  /* Seconds per call. */
+    double cv;
+};
+
+static char* baseline_path(const char* name) {
+    size_t len = strlen(name);
+    char* path = malloc(len + sizeof(".json"));
+
+    if (path) {
+        strcpy(path, name);
+        if (len < 5 || strcmp(name + len - 5, ".json"))
+            strcat(path, ".json");
+    }
+    return path;
+}
+
+static int save_baseline(const char* name, const struct result* r, int n) {
+    char* path = baseline_path(name);
+    FILE* f = path ? fopen(path, "w") : NULL;
+    int i;
+
+    if (!f) {
+        perror(path ? path : name);
+        free(path);
+        return -1;
+    }
+    fprintf(f, "{\n  \"name\": \"%s\",\n  \"results\": [\n", name);
+    for (i = 0; i < n; ++i)
+        fprintf(f, "    {\"kernel\": \"%s\", \"size\": %zu, \"align\": %zu, "
+                   "\"median\": %.6e, \"lo\": %.6e, \"hi\": %.6e, "
+                   "\"cv\": %.6e}%s\n", r[i].kernel, r[i].size, r[i].align,
+                r[i].median, r[i].lo, r[i].hi, r[i].cv,
+                i + 1 < n ? "," : "");
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+    printf("saved baseline to %s\n", path);
+    free(path);
+    return 0;
+}
+
+/* Load a baseline, returning the number of results read or -1 on error. */
+static int load_baseline(const char* name, struct result** results) {
+    char* path = baseline_path(name);
+    FILE* f = path ? fopen(path, "r") : NULL;
+    char line[512];
+    struct result r, *tmp;
+    int n = 0, max = 0;
+
+    *results = NULL;
+    if (!f) {
+        perror(path ? path : name);
+        free(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, " {\"kernel\": \"%63[^\"]\", \"size\": %zu, "
+                         "\"align\": %zu, \"median\": %lg, \"lo\": %lg, "
+                         "\"hi\": %lg, \"cv\": %lg}", r.kernel, &r.size,
+                   &r.align, &r.median, &r.lo, &r.hi, &r.cv) == 7) {
+            if (n == max) {
+                max = max ? 2 * max : 64;
+                if (!(tmp = realloc(*results, max * sizeof(r)))) {
+                    n = -1;
+                    break;
+                }
+                *results = tmp;
+            }
+            (*results)[n++] = r;
+        }
+    fclose(f);
+    if (n <= 0) {
+        fprintf(stderr, "%s: %s\n", path, n ? "out of memory"
+                                             : "no results in baseline");
+        free(*results);
+        *results = NULL;
+        n = -1;
+    }
+    free(path);
+    return n;
+}
+
+static const struct result* find_result(const struct result* rs, int n,
+                                        const struct result* r) {
+    int i;
+
+    for (i = 0; i < n; ++i)
+        if (!strcmp(rs[i].kernel, r->kernel) && rs[i].size == r->size &&
+            rs[i].align == r->align)
+            return &rs[i];
+    return NULL;
+}
+
+#define MAX_SIZES 64
+
+static int bench_main(int argc, char** argv) {
+    struct bench_options o = { -1, 31, 1e-3, 0.03 };
+    struct summary s;
+    struct fill f;
+    struct copy cp;
+    struct result* results;
+    struct result* base = NULL;
+    const struct result* b;
+    struct result* r;
+    size_t sizes[MAX_SIZES] = { 16, 64, 256, 1 << 10, 4 << 10, 64 << 10,
+                                1 << 20 };
+    size_t aligns[MAX_SIZES] = { 0, 1 };
+    size_t max_size = 0;
+    int nsizes = 7, naligns = 2, flagged = 0, regressed = 0;
+    int nbase = 0, n = 0, opt, i, j, slower, copies = 0;
+    const char* only = NULL;
+    const char* name;
+    const char* save = NULL;
+    const char* compare = NULL;
+    double tolerance = 0.05, delta;
+    byte* buffer;
+    byte* source = NULL;
+    unsigned int k, nkernels;
+
+    while ((opt = getopt(argc, argv, "c:n:t:v:s:a:k:o:b:T:C")) != -1) {
+        switch (opt) {
+            case 'c': o.cpu = atoi(optarg); break;
+            case 'n': o.trials = atoi(optarg); break;
+            case 't': o.min_trial = atof(optarg) / 1e3; break;
+            case 'v': o.max_cv = atof(optarg) / 100; break;
+            case 's': nsizes = parse_sizes(optarg, sizes, MAX_SIZES); break;
+            case 'a': naligns = parse_sizes(optarg, aligns, MAX_SIZES); break;
+            case 'k': only = optarg; break;
+            case 'o': save = optarg; break;
+            case 'b': compare = optarg; break;
+            case 'T': tolerance = atof(optarg) / 100; break;
+            case 'C': copies = 1; break;
+            default: return 2;
+        }
+    }
+    if (nsizes <= 0 || naligns <= 0 || o.trials < 5) {
+        fprintf(stderr, "need at least one size and alignment and 5 trials\n");
+        return 2;
+    }
+    for (i = 0; i < nsizes; ++i)
+        if (sizes[i] > max_size)
+            max_size = sizes[i];
+    for (i = 0; i < naligns; ++i)
+        if (aligns[i] >= 4096) {
+            fprintf(stderr, "alignment offsets must be less than 4096\n");
+            return 2;
+        }
+    if (compare && (nbase = load_baseline(compare, &base)) < 0)
+        return 1;
+
+    if (bench_start(&o))
+        return 1;
+    /* With -C we benchmark the copy kernels instead. The alignment offsets
+     * apply to the destination and the source is page aligned, so a nonzero
+     * offset also misaligns the two relative to each other.
+     */
+    nkernels = copies ? COPY_KERNELS : KERNELS;
+    results = malloc(nkernels * nsizes * naligns * sizeof(*results));
+    if (!results || posix_memalign((void**)&buffer, 4096, max_size + 4096) ||
+        (copies && posix_memalign((void**)&source, 4096, max_size))) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    memset(buffer, 0, max_size + 4096);
+    if (copies)
+        memset(source, 0x5a, max_size);
+
+    printf("%d trials of at least %g ms each, flagging cv > %g%%\n", o.trials,
+           o.min_trial * 1e3, o.max_cv * 100);
+    if (compare)
+        printf("comparing against baseline %s, tolerating %g%% slowdowns\n",
+               compare, tolerance * 100);
+    printf("\n%-30s %9s %5s %10s %21s %6s %4s", "kernel", "size", "align",
+           "GB/s", "95% CI", "cv%", "rej");
+    if (compare)
+        printf(" %10s %8s", "base GB/s", "delta");
+    printf("\n");
+
+    for (k = 0; k < nkernels; ++k) {
+        name = copies ? copy_kernels[k].name : kernels[k].name;
+        if ((only && strcmp(only, name)) ||
+            (copies ? copy_kernels[k].available &&
+                      !copy_kernels[k].available()
+                    : !available(&kernels[k])))
+            continue;
+        for (i = 0; i < nsizes; ++i)
+            for (j = 0; j < naligns; ++j) {
+                if (!copies &&
+                    (sizes[i] | aligns[j]) & (kernels[k].granularity - 1))
+                    continue;
+                if (copies) {
+                    cp.k = &copy_kernels[k];
+                    cp.dst = buffer + aligns[j];
+                    cp.src = source;
+                    cp.len = sizes[i];
+                } else {
+                    f.k = &kernels[k];
+                    f.p = buffer + aligns[j];
+                    f.len = sizes[i];
+                }
+                if (copies ? measure(run_copy, &cp, &o, &s)
+                           : measure(run_fill, &f, &o, &s)) {
+                    fprintf(stderr, "out of memory\n");
+                    return 1;
+                }
+                r = &results[n++];
+                snprintf(r->kernel, sizeof(r->kernel), "%s", name);
+                r->size = sizes[i];
+                r->align = aligns[j];
+                r->median = s.median;
+                r->lo = s.lo;
+                r->hi = s.hi;
+                r->cv = s.cv;
+
+                printf("%-30s %9zu %5zu %10.3f [%9.3f, %9.3f] %6.2f %4d",
+                       name, sizes[i], aligns[j],
+                       sizes[i] / s.median / 1e9, sizes[i] / s.hi / 1e9,
+                       sizes[i] / s.lo / 1e9, s.cv * 100, s.rejected);
+
+                /* A change is significant if the confidence intervals of the
+                 * two medians don't overlap. Deltas are in throughput, so
+                 * negative means slower.
+                 */
+                if (compare && (b = find_result(base, nbase, r))) {
+                    delta = b->median / r->median - 1;
+                    slower = r->lo > b->hi;
+                    printf(" %10.3f %+7.1f%%%s", sizes[i] / b->median / 1e9,
+                           delta * 100, slower ? " SLOWER" :
+                                        r->hi < b->lo ? " FASTER" : "");
+                    if (slower && -delta > tolerance) {
+                        printf(" REGRESSION");
+                        ++regressed;
+                    }
+                } else if (compare) {
+                    printf(" %10s %8s", "-", "new");
+                }
+                printf("%s\n", s.cv > o.max_cv ? "  NOISY" : "");
+                flagged += s.cv > o.max_cv;
+            }
+    }
+
+    if (flagged)
+        printf("\n%d measurement(s) flagged as noisy\n", flagged);
+    if (regressed)
+        printf("\n%d regression(s) beyond %g%% against baseline %s\n",
+               regressed, tolerance * 100, compare);
+    if (save && save_baseline(save, results, n))
+        return 1;
+    free(buffer);
+    free(source);
+    free(results);
+    free(base);
+    return regressed ? 1 : 0;
+}
+
+/* Sweeping sizes and alignments is all very well, but what matters is how an
+ * implementation does on the sort of calls real programs make. The workloads
+ * below are modelled on some common ones. Each is a fixed list of fills within
+ * a pool of memory, and one operation is doing every fill in the list in turn.
+ */
+struct job {
+    size_t offset, len;
+};
+
+struct workload {
+    const char* name;
+    const char* description;
+    int c;
+    size_t pool_size;
+    struct job* jobs;
+    size_t njobs;
+};
+
+static size_t round_up(size_t x, size_t align) {
+    return (x + align - 1) & ~(align - 1);
+}
+
+static struct job* alloc_jobs(struct workload* w, size_t njobs) {
+    w->njobs = njobs;
+    return w->jobs = malloc(njobs * sizeof(*w->jobs));
+}
+
+/* Resetting a SwissTable (e.g. absl::flat_hash_map) sets its control bytes to
+ * kEmpty (0x80). A table of capacity 2^k - 1 has capacity + 16 control bytes,
+ * 16 byte aligned. We reset 256 tables of assorted capacities up to 4095.
+ */
+static int swisstable_workload(struct workload* w) {
+    uint64_t state = 1;
+    size_t i, offset = 0;
+
+    if (!alloc_jobs(w, 256))
+        return -1;
+    for (i = 0; i < w->njobs; ++i) {
+        w->jobs[i].offset = offset;
+        w->jobs[i].len = ((size_t)1 << (4 + xorshift64(&state) % 9)) - 1 + 16;
+        offset = round_up(offset + w->jobs[i].len, 16);
+    }
+    w->pool_size = offset;
+    return 0;
+}
+
+/* calloc zeroing blocks of mixed sizes, log-uniformly distributed between 16
+ * bytes and 64 KiB and rounded up to malloc's 16 byte granularity.
+ */
+static int calloc_workload(struct workload* w) {
+    uint64_t state = 2;
+    size_t i, offset = 0, octave;
+
+    if (!alloc_jobs(w, 1024))
+        return -1;
+
+    /* Pick one of the twelve octaves from 16 bytes up with equal probability,
+     * then a size uniformly within it.
+     */
+    for (i = 0; i < w->njobs; ++i) {
+        w->jobs[i].offset = offset;
+        octave = (size_t)16 << xorshift64(&state) % 12;
+        w->jobs[i].len = round_up(octave + xorshift64(&state) % octave, 16);
+        offset = round_up(offset + w->jobs[i].len + 16, 16);
+    }
+    w->pool_size = offset;
+    return 0;
+}
+
+/* Clearing a 3840x2160, 32 bits per pixel framebuffer. */
+static int framebuffer_workload(struct workload* w) {
+    if (!alloc_jobs(w, 1))
+        return -1;
+    w->jobs[0].offset = 0;
+    w->jobs[0].len = w->pool_size = 3840 * 2160 * 4;
+    return 0;
+}
+
+/* Zeroing each buffer of a 256 entry network receive ring before handing it
+ * back to the NIC, for standard and jumbo frames.
+ */
+static int rx_ring_workload(struct workload* w, size_t frame) {
+    size_t stride = round_up(frame, 2048), i;
+
+    if (!alloc_jobs(w, 256))
+        return -1;
+    for (i = 0; i < w->njobs; ++i) {
+        w->jobs[i].offset = i * stride;
+        w->jobs[i].len = frame;
+    }
+    w->pool_size = w->njobs * stride;
+    return 0;
+}
+
+static int rx1500_workload(struct workload* w) {
+    return rx_ring_workload(w, 1500);
+}
+
+static int rx9000_workload(struct workload* w) {
+    return rx_ring_workload(w, 9000);
+}
+
+/* Clearing 4 KiB pages, as a kernel does before handing them to a process,
+ * scattered around a 64 MiB pool.
+ */
+static int pages_workload(struct workload* w) {
+    uint64_t state = 3;
+    size_t i, j, t;
+
+    if (!alloc_jobs(w, 16384))
+        return -1;
+    for (i = 0; i < w->njobs; ++i) {
+        w->jobs[i].offset = i * 4096;
+        w->jobs[i].len = 4096;
+    }
+    for (i = w->njobs - 1; i > 0; --i) {
+        j = xorshift64(&state) % (i + 1);
+        t = w->jobs[i].offset;
+        w->jobs[i].offset = w->jobs[j].offset;
+        w->jobs[j].offset = t;
+    }
+    w->pool_size = w->njobs * 4096;
+    return 0;
+}
+
+static const struct {
+    const char* name;
+    const char* description;
+    int c;
+    int (*build)(struct workload* w);
+} workloads[] = {
+    { "swisstable", "SwissTable control byte reset (0x80)", 0x80,
+      swisstable_workload },
+    { "calloc", "calloc-style zeroing of mixed sizes", 0, calloc_workload },
+    { "framebuffer", "3840x2160x32bpp framebuffer clear", 0,
+      framebuffer_workload },
+    { "rx1500", "network RX ring zeroing, 1500 byte frames", 0,
+      rx1500_workload },
+    { "rx9000", "network RX ring zeroing, 9000 byte frames", 0,
+      rx9000_workload },
+    { "pages", "4 KiB page clearing", 0, pages_workload },
+};
+
+struct replay {
+    const struct kernel* k;
+    const struct workload* w;
+    byte* pool;
+};
+
+static void run_replay(void* arg) {
+    struct replay* r = arg;
+    size_t i;
+
+    for (i = 0; i < r->w->njobs; ++i)
+        r->k->f(r->pool + r->w->jobs[i].offset, r->w->c, r->w->jobs[i].len);
+}
+
+/* Whether kernel k can do every fill in workload w. */
+static int can_replay(const struct kernel* k, const struct workload* w) {
+    size_t i;
+
+    for (i = 0; i < w->njobs; ++i)
+        if ((w->jobs[i].offset | w->jobs[i].len) & (k->granularity - 1))
+            return 0;
+    return 1;
+}
+
+static int workloads_main(int argc, char** argv) {
+    struct bench_options o = { -1, 15, 1e-3, 0.03 };
+    struct summary s;
+    struct workload w;
+    struct replay r;
+    const char* only_workload = NULL;
+    const char* only_kernel = NULL;
+    size_t bytes, i;
+    unsigned int j, k;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:n:w:k:")) != -1) {
+        switch (opt) {
+            case 'c': o.cpu = atoi(optarg); break;
+            case 'n': o.trials = atoi(optarg); break;
+            case 'w': only_workload = optarg; break;
+            case 'k': only_kernel = optarg; break;
+            default: return 2;
+        }
+    }
+    if (o.trials < 5) {
+        fprintf(stderr, "need at least 5 trials\n");
+        return 2;
+    }
+    if (bench_start(&o))
+        return 1;
+
+    for (j = 0; j < sizeof(workloads) / sizeof(workloads[0]); ++j) {
+        if (only_workload && strcmp(only_workload, workloads[j].name))
+            continue;
+        w.name = workloads[j].name;
+        w.description = workloads[j].description;
+        w.c = workloads[j].c;
+        if (workloads[j].build(&w) ||
+            posix_memalign((void**)&r.pool, 4096, w.pool_size)) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        memset(r.pool, 0, w.pool_size);
+        for (bytes = 0, i = 0; i < w.njobs; ++i)
+            bytes += w.jobs[i].len;
+
+        printf("\n%s: %s\n%zu fills, %zu bytes per operation\n", w.name,
+               w.description, w.njobs, bytes);
+        printf("%-30s %12s %27s %10s\n", "kernel", "us/op", "95% CI", "GB/s");
+        for (k = 0; k < KERNELS; ++k) {
+            if ((only_kernel && strcmp(only_kernel, kernels[k].name)) ||
+                !available(&kernels[k]))
+                continue;
+            if (!can_replay(&kernels[k], &w)) {
+                printf("%-30s %12s\n", kernels[k].name, "n/a");
+                continue;
+            }
+            r.k = &kernels[k];
+            r.w = &w;
+            if (measure(run_replay, &r, &o, &s)) {
+                fprintf(stderr, "out of memory\n");
+                return 1;
+            }
+            printf("%-30s %12.2f [%11.2f, %11.2f] %10.3f%s\n",
+                   kernels[k].name, s.median * 1e6, s.lo * 1e6, s.hi * 1e6,
+                   bytes / s.median / 1e9, s.cv > o.max_cv ? "  NOISY" : "");
+        }
+        free(r.pool);
+        free(w.jobs);
+    }
+    return 0;
+}
+
+/* To see what happens to an implementation when the instruction cache is under
+ * pressure we need a large amount of code to run between calls. Here are 1024
+ * small functions, each slightly different so the compiler can't merge them,
+ * totalling a few tens of kilobytes: more than a typical L1 instruction cache.
+ * The benchmark below calls all of them before each fill, and times only the
+ * fill itself. Comparing that to the time for a fill without the pad functions
+ * gives the cost of running with a cold instruction cache.
+ */
+#define PAD(n) \
+    static __attribute__((noinline)) uint64_t pad_##n(uint64_t x) { \
+        x ^= x >> 31; \
+        x *= 0x9e3779b97f4a7c15ULL + n##ULL; \
+        x ^= x >> 29; \
+        x += 0xbf58476d1ce4e5b9ULL ^ n##ULL; \
+        x ^= x << 17; \
+        return x * (n##ULL | 1); \
+    }
+#define PAD_PTR(n) pad_##n,
+#define REP4(M, n) M(n##0) M(n##1) M(n##2) M(n##3)
+#define REP16(M, n) REP4(M, n##0) REP4(M, n##1) REP4(M, n##2) REP4(M, n##3)
+#define REP64(M, n) \
+    REP16(M, n##0) REP16(M, n##1) REP16(M, n##2) REP16(M, n##3)
+#define REP256(M, n) \
+    REP64(M, n##0) REP64(M, n##1) REP64(M, n##2) REP64(M, n##3)
+#define REP1024(M, n) \
+    REP256(M, n##0) REP256(M, n##1) REP256(M, n##2) REP256(M, n##3)
+
+REP1024(PAD, 0)
+
+static uint64_t (*const pads[])(uint64_t) = { REP1024(PAD_PTR, 0) };
+
+#define PADS (sizeof(pads) / sizeof(pads[0]))
+
+struct pressure {
+    const struct kernel* k;  /* NULL to time nothing, for the timer overhead. */
+    byte* p;
+    size_t len;
+    size_t npads;
+    uint64_t sink;
+};
+
+/* Returns the time taken by the fill in seconds. */
+static double run_pressure(struct pressure* pr) {
+    uint64_t x = pr->sink;
+    double start;
+    size_t i;
+
+    for (i = 0; i < pr->npads; ++i)
+        x = pads[i](x);
+    pr->sink = x;
+    start = now();
+    if (pr->k)
+        pr->k->f(pr->p, 0x5a, pr->len);
+    return now() - start;
+}
+
+/* As measure, but timing only the fills. */
+static int measure_pressure(struct pressure* pr, const struct bench_options* o,
+                            struct summary* s) {
+    double* samples = malloc(o->trials * sizeof(double));
+    double t;
+    int i, j, reps = 256;
+
+    if (!samples)
+        return -1;
+    for (j = 0; j < reps; ++j)
+        run_pressure(pr);
+    for (i = 0; i < o->trials; ++i) {
+        for (t = 0, j = 0; j < reps; ++j)
+            t += run_pressure(pr);
+        samples[i] = t / reps;
+    }
+    summarise(samples, o->trials, s);
+    free(samples);
+    return 0;
+}
+
+static int icache_main(int argc, char** argv) {
+    struct bench_options o = { -1, 31, 1e-3, 0.03 };
+    struct summary hot, cold, timer;
+    struct pressure pr;
+    size_t sizes[MAX_SIZES] = { 64, 256, 2048 };
+    size_t max_size = 0, npads = PADS;
+    int nsizes = 3, opt, i;
+    const char* only = NULL;
+    unsigned int k;
+
+    while ((opt = getopt(argc, argv, "c:n:s:f:k:")) != -1) {
+        switch (opt) {
+            case 'c': o.cpu = atoi(optarg); break;
+            case 'n': o.trials = atoi(optarg); break;
+            case 's': nsizes = parse_sizes(optarg, sizes, MAX_SIZES); break;
+            case 'f': npads = strtoul(optarg, NULL, 0); break;
+            case 'k': only = optarg; break;
+            default: return 2;
+        }
+    }
+    if (nsizes <= 0 || o.trials < 5 || npads > PADS) {
+        fprintf(stderr, "need at least one size, 5 trials and at most %zu "
+                        "pad functions\n", (size_t)PADS);
+        return 2;
+    }
+    for (i = 0; i < nsizes; ++i)
+        if (sizes[i] > max_size)
+            max_size = sizes[i];
+    if (bench_start(&o))
+        return 1;
+    if (posix_memalign((void**)&pr.p, 4096, max_size + 1)) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    memset(pr.p, 0, max_size + 1);
+    pr.sink = 1;
+
+    pr.k = NULL;
+    pr.npads = 0;
+    if (measure_pressure(&pr, &o, &timer)) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    printf("%zu pad functions between fills, timer overhead %.1f ns\n\n",
+           npads, timer.median * 1e9);
+    printf("%-30s %9s %10s %10s %10s\n", "kernel", "size", "hot ns",
+           "cold ns", "penalty");
+
+    for (k = 0; k < KERNELS; ++k) {
+        if ((only && strcmp(only, kernels[k].name)) ||
+            !available(&kernels[k]))
+            continue;
+        for (i = 0; i < nsizes; ++i) {
+            if (sizes[i] & (kernels[k].granularity - 1))
+                continue;
+            pr.k = &kernels[k];
+            pr.len = sizes[i];
+            pr.npads = 0;
+            if (measure_pressure(&pr, &o, &hot)) {
+                fprintf(stderr, "out of memory\n");
+                return 1;
+            }
+            pr.npads = npads;
+            if (measure_pressure(&pr, &o, &cold)) {
+                fprintf(stderr, "out of memory\n");
+                return 1;
+            }
+            printf("%-30s %9zu %10.1f %10.1f %+9.1f%s\n", kernels[k].name,
+                   sizes[i], (hot.median - timer.median) * 1e9,
+                   (cold.median - timer.median) * 1e9,
+                   (cold.median - hot.median) * 1e9,
+                   hot.cv > o.max_cv || cold.cv > o.max_cv ? "  NOISY" : "");
+        }
+    }
+    free(pr.p);
+    return 0;
+}
+
+/* How much a tracked region saves over resetting everything depends on how
+ * many pages were written. One operation here writes to some number of pages
+ * at random and then resets the region, either with tracked_region_reset or
+ * with a full memset_bulk.
+ */
+struct scratch {
+    struct tracked_region* r;
+    size_t touched;
+    int full;
+    uint64_t state;
+};
+
+static void run_scratch(void* arg) {
+    struct scratch* sc = arg;
+    size_t page = sysconf(_SC_PAGESIZE), npages = sc->r->size / page, i;
+
+    for (i = 0; i < sc->touched; ++i)
+        sc->r->base[xorshift64(&sc->state) % npages * page] = 1;
+    if (sc->full)
+        memset_bulk(sc->r->base, sc->r->c, sc->r->size);
+    else
+        tracked_region_reset(sc->r);
+}
+
+static int tracked_main(int argc, char** argv) {
+    struct bench_options o = { -1, 15, 1e-3, 0.03 };
+    struct summary full, tracked;
+    struct scratch sc;
+    size_t touched[MAX_SIZES] = { 1, 16, 256, 4096 };
+    size_t size = 64 << 20;
+    int ntouched = 4, opt, i;
+
+    while ((opt = getopt(argc, argv, "c:n:s:p:")) != -1) {
+        switch (opt) {
+            case 'c': o.cpu = atoi(optarg); break;
+            case 'n': o.trials = atoi(optarg); break;
+            case 's': size = parse_size(optarg); break;
+            case 'p': ntouched = parse_sizes(optarg, touched, MAX_SIZES); break;
+            default: return 2;
+        }
+    }
+    if (!size || ntouched <= 0 || o.trials < 5) {
+        fprintf(stderr, "need a size, page counts and at least 5 trials\n");
+        return 2;
+    }
+    if (bench_start(&o))
+        return 1;
+    if (!(sc.r = tracked_region_create(size, 0))) {
+        perror("tracked_region_create");
+        return 1;
+    }
+    sc.state = 1;
+    memset_bulk(sc.r->base, 0, sc.r->size);
+    tracked_region_reset(sc.r);
+
+    printf("%zu MiB region, soft-dirty tracking %s\n\n", sc.r->size >> 20,
+           sc.r->tracking ? "works" : "unavailable; resets are full fills");
+    printf("%10s %12s %12s %9s\n", "pages", "full us", "tracked us",
+           "speedup");
+    for (i = 0; i < ntouched; ++i) {
+        sc.touched = touched[i];
+        sc.full = 1;
+        if (measure(run_scratch, &sc, &o, &full))
+            return 1;
+        sc.full = 0;
+        if (measure(run_scratch, &sc, &o, &tracked))
+            return 1;
+        printf("%10zu %12.1f %12.1f %8.1fx%s\n", touched[i], full.median * 1e6,
+               tracked.median * 1e6, full.median / tracked.median,
+               full.cv > o.max_cv || tracked.cv > o.max_cv ? "  NOISY" : "");
+    }
+    tracked_region_destroy(sc.r);
+    return 0;
+}
+
+/* Lazy regions win when only a fraction of the region is used after each
+ * reset. One operation here resets a region and then reads one byte from some
+ * fraction of its pages (scattered at random), comparing a lazy reset with an
+ * eager memset_bulk of the whole region. The eager region is plain anonymous
+ * memory, so its faults don't go through userfaultfd.
+ */
+struct lazy_op {
+    struct lazy_region* r;   /* NULL for the eager region. */
+    byte* base;
+    size_t* pages;           /* Offsets of the pages to touch. */
+    size_t size, touched;
+    int c;
+    uint64_t sink;
+};
+
+static void run_lazy(void* arg) {
+    struct lazy_op* op = arg;
+    uint64_t sum = op->sink;
+    size_t i;
+
+    if (op->r)
+        lazy_region_reset(op->r, op->c);
+    else
+        memset_bulk(op->base, op->c, op->size);
+    for (i = 0; i < op->touched; ++i)
+        sum += ((volatile byte*)op->base)[op->pages[i]];
+    op->sink = sum;
+}
+
+static int lazy_main(int argc, char** argv) {
+    struct bench_options o = { -1, 11, 1e-3, 0.03 };
+    struct summary eager, lazy;
+    struct lazy_op op;
+    struct lazy_region* r;
+    byte* eager_base;
+    size_t size = 64 << 20, page = sysconf(_SC_PAGESIZE), npages, i, j, t;
+    double fractions[MAX_SIZES] = { 0, 0.01, 0.1, 0.5, 1 };
+    int nfractions = 5, opt, k;
+    char* tok;
+    uint64_t state = 1;
+
+    op.c = 0x5a;
+    while ((opt = getopt(argc, argv, "c:n:s:f:v:")) != -1) {
+        switch (opt) {
+            case 'c': o.cpu = atoi(optarg); break;
+            case 'n': o.trials = atoi(optarg); break;
+            case 's': size = parse_size(optarg); break;
+            case 'f':
+                nfractions = 0;
+                for (tok = strtok(optarg, ","); tok && nfractions < MAX_SIZES;
+                     tok = strtok(NULL, ","))
+                    fractions[nfractions++] = atof(tok) / 100;
+                break;
+            case 'v': op.c = strtol(optarg, NULL, 0); break;
+            default: return 2;
+        }
+    }
+    if (!size || !nfractions || o.trials < 5) {
+        fprintf(stderr, "need a size, fractions and at least 5 trials\n");
+        return 2;
+    }
+    if (bench_start(&o))
+        return 1;
+    r = lazy_region_create(size, op.c);
+    eager_base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    npages = size / page;
+    op.pages = malloc(npages * sizeof(size_t));
+    if (!r || eager_base == MAP_FAILED || !op.pages) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    op.size = size;
+    for (i = 0; i < npages; ++i)
+        op.pages[i] = i * page;
+    for (i = npages - 1; i > 0; --i) {
+        j = xorshift64(&state) % (i + 1);
+        t = op.pages[i];
+        op.pages[i] = op.pages[j];
+        op.pages[j] = t;
+    }
+    op.sink = 0;
+
+    printf("%zu MiB region filled with 0x%02x, %s\n\n", size >> 20, op.c & 0xff,
+           lazy_region_is_lazy(r) ? "using userfaultfd"
+           : op.c & 0xff ? "userfaultfd unavailable; resets are eager"
+                         : "userfaultfd unavailable; using MADV_DONTNEED");
+    printf("%9s %12s %12s %9s\n", "touched", "eager us", "lazy us", "speedup");
+    for (k = 0; k < nfractions; ++k) {
+        op.touched = (size_t)(fractions[k] * npages);
+        if (op.touched > npages)
+            op.touched = npages;
+        op.r = NULL;
+        op.base = eager_base;
+        if (measure(run_lazy, &op, &o, &eager))
+            return 1;
+        op.r = r;
+        op.base = lazy_region_base(r);
+        if (measure(run_lazy, &op, &o, &lazy))
+            return 1;
+        printf("%8.1f%% %12.1f %12.1f %8.1fx%s\n", fractions[k] * 100,
+               eager.median * 1e6, lazy.median * 1e6,
+               eager.median / lazy.median,
+               eager.cv > o.max_cv || lazy.cv > o.max_cv ? "  NOISY" : "");
+    }
+    lazy_region_destroy(r);
+    munmap(eager_base, size);
+    free(op.pages);
+    return 0;
+}
+
+/* Recycling a log segment in a mapped file: write to every page of it and
+ * sync, as the log would, then zero it and sync again, either with stores or
+ * with zero_mapped_file_range. Both pay for the first half, so the difference
+ * is down to the zeroing and its writeback.
+ */
+struct segment {
+    byte* base;
+    size_t size;
+    int fallocate;
+};
+
+static void run_segment(void* arg) {
+    struct segment* sg = arg;
+    size_t page = sysconf(_SC_PAGESIZE), i;
+
+    for (i = 0; i < sg->size; i += page)
+        sg->base[i] = 0xab;
+    msync(sg->base, sg->size, MS_SYNC);
+    if (sg->fallocate)
+        zero_mapped_file_range(sg->base, sg->size);
+    else
+        memset_bulk(sg->base, 0, sg->size);
+    msync(sg->base, sg->size, MS_SYNC);
+}
+
+static int filezero_main(int argc, char** argv) {
+    struct bench_options o = { -1, 7, 1e-2, 0.05 };
+    struct summary stores, falloc;
+    struct segment sg;
+    const char* dirs[8] = { "/dev/shm", "." };
+    char path[4096];
+    int ndirs = 0, opt, i, failed, fd;
+
+    sg.size = 16 << 20;
+    while ((opt = getopt(argc, argv, "c:n:s:d:")) != -1) {
+        switch (opt) {
+            case 'c': o.cpu = atoi(optarg); break;
+            case 'n': o.trials = atoi(optarg); break;
+            case 's': sg.size = parse_size(optarg); break;
+            case 'd':
+                if (ndirs < 8)
+                    dirs[ndirs++] = optarg;
+                break;
+            default: return 2;
+        }
+    }
+    if (!ndirs)
+        ndirs = 2;
+    if (!sg.size || o.trials < 5) {
+        fprintf(stderr, "need a size and at least 5 trials\n");
+        return 2;
+    }
+    if (bench_start(&o))
+        return 1;
+
+    printf("%zu MiB segment; times are to dirty, sync, zero and sync again\n\n",
+           sg.size >> 20);
+    printf("%-24s %12s %12s %9s\n", "directory", "stores us", "fallocate us",
+           "speedup");
+    for (i = 0; i < ndirs; ++i) {
+        snprintf(path, sizeof(path), "%s/memset-filezero.XXXXXX", dirs[i]);
+        /* zero_mapped_file_range opens the file by name, so we can only
+         * unlink it once we're done.
+         */
+        if ((fd = mkstemp(path)) < 0) {
+            perror(path);
+            return 1;
+        }
+        if (ftruncate(fd, sg.size) ||
+            (sg.base = mmap(NULL, sg.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                            fd, 0)) == MAP_FAILED) {
+            perror(dirs[i]);
+            unlink(path);
+            return 1;
+        }
+        sg.fallocate = 0;
+        failed = measure(run_segment, &sg, &o, &stores);
+        sg.fallocate = 1;
+        failed = failed || measure(run_segment, &sg, &o, &falloc);
+        unlink(path);
+        if (failed)
+            return 1;
+        printf("%-24s %12.1f %12.1f %8.1fx%s\n", dirs[i],
+               stores.median * 1e6, falloc.median * 1e6,
+               stores.median / falloc.median,
+               stores.cv > o.max_cv || falloc.cv > o.max_cv ? "  NOISY" : "");
+        munmap(sg.base, sg.size);
+        close(fd);
+    }
+    return 0;
+}
+
+/* Preallocating a journal in a mapped file, as it's often done, one block at
+ * a time with an msync after each, or all at once with durable_fill.
+ */
+struct journal {
+    byte* base;
+    size_t size, block;
+    int how;           /* 0 per block, 1 durable_fill, 2 with flush_lines. */
+};
+
+static void run_journal(void* arg) {
+    struct journal* j = arg;
+    size_t i;
+
+    if (j->how) {
+        durable_fill(j->base, 0, j->size, j->how == 2);
+        return;
+    }
+    for (i = 0; i < j->size; i += j->block) {
+        memset_bulk(j->base + i, 0, j->block);
+        msync(j->base + i, j->block, MS_SYNC);
+    }
+}
+
+static int durable_main(int argc, char** argv) {
+    struct bench_options o = { -1, 7, 1e-2, 0.05 };
+    struct summary t[3];
+    struct journal j;
+    size_t blocks[MAX_SIZES] = { 4096, 65536 };
+    const char* dir = ".";
+    char path[4096];
+    int nblocks = 2, opt, i, k, fd;
+
+    j.size = 16 << 20;
+    while ((opt = getopt(argc, argv, "c:n:s:b:d:")) != -1) {
+        switch (opt) {
+            case 'c': o.cpu = atoi(optarg); break;
+            case 'n': o.trials = atoi(optarg); break;
+            case 's': j.size = parse_size(optarg); break;
+            case 'b': nblocks = parse_sizes(optarg, blocks, MAX_SIZES); break;
+            case 'd': dir = optarg; break;
+            default: return 2;
+        }
+    }
+    if (!j.size || nblocks <= 0 || o.trials < 5) {
+        fprintf(stderr, "need a size, block sizes and at least 5 trials\n");
+        return 2;
+    }
+    if (bench_start(&o))
+        return 1;
+    snprintf(path, sizeof(path), "%s/memset-durable.XXXXXX", dir);
+    if ((fd = mkstemp(path)) < 0) {
+        perror(path);
+        return 1;
+    }
+    unlink(path);
+    if (ftruncate(fd, j.size) ||
+        (j.base = mmap(NULL, j.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                       0)) == MAP_FAILED) {
+        perror(dir);
+        return 1;
+    }
+
+    printf("%zu MiB journal in %s\n\n", j.size >> 20, dir);
+    printf("%10s %14s %14s %14s\n", "block", "per block us", "durable us",
+           "+flush us");
+    for (i = 0; i < nblocks; ++i) {
+        j.block = blocks[i];
+        if (!j.block || j.size % j.block) {
+            fprintf(stderr, "block sizes must divide the journal size\n");
+            return 2;
+        }
+        for (k = 0; k < 3; ++k) {
+            j.how = k;
+            if (measure(run_journal, &j, &o, &t[k]))
+                return 1;
+        }
+        printf("%10zu %14.1f %14.1f %14.1f%s\n", j.block, t[0].median * 1e6,
+               t[1].median * 1e6, t[2].median * 1e6,
+               t[0].cv > o.max_cv || t[1].cv > o.max_cv || t[2].cv > o.max_cv
+               ? "  NOISY" : "");
+    }
+    munmap(j.base, j.size);
+    close(fd);
+    return 0;
+}
+
+/* Wall clock timings are useless on a busy shared machine, so we also have a
+ * way of simply running an implementation with fixed inputs. Running this under
+ * a simulator like valgrind's callgrind (see icount.sh) gives deterministic
+ * instruction, branch and cache miss counts that can be compared run to run.
+ */
+static const struct kernel* find_kernel(const char* name) {
+    unsigned int i;
+
+    for (i = 0; i < KERNELS; ++i)
+        if (!strcmp(kernels[i].name, name) && available(&kernels[i]))
+            return &kernels[i];
+    return NULL;
+}
+
+static const struct copy_kernel* find_copy_kernel(const char* name) {
+    unsigned int i;
+
+    for (i = 0; i < COPY_KERNELS; ++i)
+        if (!strcmp(copy_kernels[i].name, name) &&
+            (!copy_kernels[i].available || copy_kernels[i].available()))
+            return &copy_kernels[i];
+    return NULL;
+}
+
+/* With -C, run a copy kernel instead, copying from a page aligned source. -l
+ * lists copy kernels with a granularity of 1, so scripts can treat the two
+ * lists alike.
+ */
+static int run_main(int argc, char** argv) {
+    const struct kernel* k = NULL;
+    const struct copy_kernel* ck = NULL;
+    const char* name = NULL;
+    size_t size = 4096, align = 0, granularity = 1;
+    unsigned long iterations = 1, i;
+    byte* buffer;
+    byte* source = NULL;
+    unsigned int j;
+    int opt, list = 0, copies = 0;
+
+    while ((opt = getopt(argc, argv, "lk:s:a:i:C")) != -1) {
+        switch (opt) {
+            case 'l': list = 1; break;
+            case 'k': name = optarg; break;
+            case 's': size = parse_size(optarg); break;
+            case 'a': align = strtoul(optarg, NULL, 0); break;
+            case 'i': iterations = strtoul(optarg, NULL, 0); break;
+            case 'C': copies = 1; break;
+            default: return 2;
+        }
+    }
+    if (list) {
+        for (j = 0; j < (copies ? COPY_KERNELS : KERNELS); ++j)
+            if (copies ? !copy_kernels[j].available ||
+                         copy_kernels[j].available()
+                       : available(&kernels[j]))
+                printf("%s %zu\n", copies ? copy_kernels[j].name
+                                          : kernels[j].name,
+                       copies ? (size_t)1 : kernels[j].granularity);
+        return 0;
+    }
+    if (!name) {
+        fprintf(stderr, "no kernel given\n");
+        return 2;
+    }
+    if (copies)
+        ck = find_copy_kernel(name);
+    else if ((k = find_kernel(name)))
+        granularity = k->granularity;
+    if (!k && !ck) {
+        fprintf(stderr, "unknown kernel %s\n", name);
+        return 2;
+    }
+    if ((size | align) & (granularity - 1)) {
+        fprintf(stderr, "%s needs sizes and alignments that are multiples of "
+                        "%zu\n", name, granularity);
+        return 2;
+    }
+    if (posix_memalign((void**)&buffer, 4096, size + align) ||
+        (ck && posix_memalign((void**)&source, 4096, size))) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    /* Touch the buffers a byte at a time rather than with memset, which
+     * icount.sh would count as part of libc's memset.
+     */
+    for (i = 0; i < size + align; ++i)
+        ((volatile byte*)buffer)[i] = 0;
+    for (i = 0; ck && i < size; ++i)
+        ((volatile byte*)source)[i] = 0x5a;
+    for (i = 0; i < iterations; ++i)
+        if (ck)
+            ck->f(buffer + align, source, size);
+        else
+            k->f(buffer + align, 0x5a, size);
+    free(buffer);
+    free(source);
+    return 0;
+}
+
+/* Report what memset_bulk has chosen here, including any overrides from the
+ * environment, and which implementation each size would get.
+ */
+static int impl_main(int argc, char** argv) {
+    struct memset_bulk_info info;
+    size_t sizes[MAX_SIZES] = { 64, 256, 4 << 10, 64 << 10, 1 << 20,
+                                64 << 20 };
+    int nsizes = 6, opt, i;
+
+    while ((opt = getopt(argc, argv, "s:")) != -1) {
+        switch (opt) {
+            case 's': nsizes = parse_sizes(optarg, sizes, MAX_SIZES); break;
+            default: return 2;
+        }
+    }
+    if (nsizes <= 0) {
+        fprintf(stderr, "need at least one size\n");
+        return 2;
+    }
+    memset_bulk_query(&info);
+    printf("tuned for: %s\n", info.tuning);
+    printf("implementation: %s%s\n", info.impl,
+           info.overridden ? " (overridden by the environment)" : "");
+    printf("rep stosb from: %zu\n", info.erms_threshold);
+    printf("non-temporal from: %zu\n\n", info.nt_threshold);
+    for (i = 0; i < nsizes; ++i)
+        printf("%12zu %s\n", sizes[i], memset_bulk_impl_for(sizes[i]));
+    return 0;
+}
+
+/* Everything above works in buffers of at most a few megabytes, which never
+ * gets near the non-temporal threshold, the limits of the TLB or the point
+ * where memset_ex goes parallel. The large mode maps buffers of up to as much
+ * memory as the machine has, optionally backed by huge pages, and times fills
+ * of them. The first fill of each buffer is timed separately, since it also
+ * pays for faulting every page in. After every fill we check the whole buffer
+ * holds the value, which needs a verifier that runs at memory bandwidth or it
+ * would dominate the run. With -C we time the copy kernels instead, copying
+ * from a second buffer that has been filled with the value.
+ */
+AS_WRITTEN
+static size_t word_verify(const byte* p, int c, size_t n) {
+    uint64_t x = (uint64_t)(c & 0xff) * 0x0101010101010101ULL, a, b, d, e;
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        MEMSET_LOAD(memset_u64, a, p + i);
+        MEMSET_LOAD(memset_u64, b, p + i + 8);
+        MEMSET_LOAD(memset_u64, d, p + i + 16);
+        MEMSET_LOAD(memset_u64, e, p + i + 24);
+        if ((a ^ x) | (b ^ x) | (d ^ x) | (e ^ x))
+            break;
+    }
+    for (; i < n && p[i] == (byte)c; ++i);
+    return i;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static size_t avx2_verify(const byte* p, int c, size_t n) {
+    __m256i v = _mm256_set1_epi8((char)c), m;
+    size_t i = 0;
+
+    for (; i + 128 <= n; i += 128) {
+        m = _mm256_and_si256(
+            _mm256_and_si256(
+                _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + i)),
+                                  v),
+                _mm256_cmpeq_epi8(
+                    _mm256_loadu_si256((const __m256i*)(p + i + 32)), v)),
+            _mm256_and_si256(
+                _mm256_cmpeq_epi8(
+                    _mm256_loadu_si256((const __m256i*)(p + i + 64)), v),
+                _mm256_cmpeq_epi8(
+                    _mm256_loadu_si256((const __m256i*)(p + i + 96)), v)));
+        if (_mm256_movemask_epi8(m) != -1)
+            break;
+    }
+    for (; i < n && p[i] == (byte)c; ++i);
+    return i;
+}
+#endif
+
+/* Returns the offset of the first byte at p that isn't c, or n. */
+static size_t verify_fill(const byte* p, int c, size_t n) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (have_avx2())
+        return avx2_verify(p, c, n);
+#endif
+    return word_verify(p, c, n);
+}
+
+static void* parallel_memset(void* s, int c, size_t n) {
+    return memset_ex(s, c, n, MEMSET_PARALLEL_OK);
+}
+
+static const struct kernel parallel_kernel = {
+    "parallel_memset", parallel_memset, 1
+};
+
+static int large_main(int argc, char** argv) {
+    struct summary s;
+    const struct kernel* ks[MAX_SIZES];
+    const struct copy_kernel* cks[MAX_SIZES];
+    size_t sizes[MAX_SIZES] = { 256 << 20, 1ul << 30 };
+    size_t max_size = 0, page = sysconf(_SC_PAGESIZE), at;
+    long phys = sysconf(_SC_PHYS_PAGES);
+    const char* huge = "none";
+    char defaults[] = "memset,memset_bulk,rep_stosb_memset,avx2_memset,"
+                      "nt_memset,parallel_memset";
+    char copy_defaults[] = "memcpy,memcpy_bulk,rep_movsb_memcpy,avx2_memmove,"
+                           "nt_memcpy";
+    char* names = NULL;
+    const char* name;
+    char* tok;
+    double* samples;
+    double first = 0, verify = 0, t;
+    int nsizes = 2, nkernels = 0, trials = 5, cpu = -1, opt, i, j, trial;
+    int bad = 0, flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, c;
+    int copies = 0;
+    byte* p;
+    byte* src = NULL;
+
+    while ((opt = getopt(argc, argv, "c:n:s:k:H:C")) != -1) {
+        switch (opt) {
+            case 'c': cpu = atoi(optarg); break;
+            case 'n': trials = atoi(optarg); break;
+            case 's': nsizes = parse_sizes(optarg, sizes, MAX_SIZES); break;
+            case 'k': names = optarg; break;
+            case 'H': huge = optarg; break;
+            case 'C': copies = 1; break;
+            default: return 2;
+        }
+    }
+    if (nsizes <= 0 || trials < 1) {
+        fprintf(stderr, "need at least one size and one trial\n");
+        return 2;
+    }
+    /* Without a reservation, running out of huge pages would be a SIGBUS
+     * when we touch them rather than mmap failing.
+     */
+    if (!strcmp(huge, "hugetlb")) {
+        flags = (flags & ~MAP_NORESERVE) | MAP_HUGETLB;
+    } else if (strcmp(huge, "thp") && strcmp(huge, "none")) {
+        fprintf(stderr, "huge pages must be none, thp or hugetlb\n");
+        return 2;
+    }
+    for (tok = strtok(names ? names : copies ? copy_defaults : defaults, ",");
+         tok && nkernels < MAX_SIZES; tok = strtok(NULL, ",")) {
+        if (copies) {
+            if ((cks[nkernels] = find_copy_kernel(tok)))
+                ++nkernels;
+            else if (names) {
+                fprintf(stderr, "unknown kernel %s\n", tok);
+                return 2;
+            }
+        } else if (!strcmp(tok, parallel_kernel.name))
+            ks[nkernels++] = &parallel_kernel;
+        else if ((ks[nkernels] = find_kernel(tok)))
+            ++nkernels;
+        else if (names) {
+            fprintf(stderr, "unknown kernel %s\n", tok);
+            return 2;
+        }
+    }
+    for (i = 0; i < nsizes; ++i)
+        if (sizes[i] > max_size)
+            max_size = sizes[i];
+    if (phys > 0 && max_size / page * (copies + 1) >= (size_t)phys) {
+        fprintf(stderr, "%zu MiB is more memory than this machine has\n",
+                max_size >> 20);
+        return 1;
+    }
+    /* By default we don't pin, so that the parallel fills can spread out. */
+    if (cpu >= 0 && pin_to_cpu(cpu)) {
+        perror("sched_setaffinity");
+        return 1;
+    }
+    if (!(samples = malloc(trials * sizeof(double))))
+        return 1;
+
+    printf("huge pages: %s, %d trials, verifying with %s\n\n", huge, trials,
+#if defined(__x86_64__) || defined(__i386__)
+           have_avx2() ? "AVX2" :
+#endif
+           "words");
+    printf("%-20s %12s %11s %10s %21s %11s\n", "kernel", "size",
+           "first GB/s", "GB/s", "95% CI", "verify GB/s");
+    for (i = 0; i < nsizes; ++i) {
+        for (j = 0; j < nkernels; ++j) {
+            if (!copies && sizes[i] & (ks[j]->granularity - 1))
+                continue;
+            name = copies ? cks[j]->name : ks[j]->name;
+            p = mmap(NULL, sizes[i], PROT_READ | PROT_WRITE, flags, -1, 0);
+            if (copies && p != MAP_FAILED &&
+                (src = mmap(NULL, sizes[i], PROT_READ | PROT_WRITE, flags, -1,
+                            0)) == MAP_FAILED) {
+                munmap(p, sizes[i]);
+                p = MAP_FAILED;
+            }
+            if (p == MAP_FAILED) {
+                perror("mmap");
+                if (flags & MAP_HUGETLB)
+                    fprintf(stderr, "are enough huge pages reserved in "
+                                    "/proc/sys/vm/nr_hugepages?\n");
+                return 1;
+            }
+            if (!strcmp(huge, "thp")) {
+                madvise(p, sizes[i], MADV_HUGEPAGE);
+                if (copies)
+                    madvise(src, sizes[i], MADV_HUGEPAGE);
+            }
+
+            /* Each fill uses a different value from the last, so a kernel
+             * that does nothing can't pass.
+             */
+            for (trial = -1; trial < trials && !bad; ++trial) {
+                c = 0x11 * (trial + 2);
+                if (copies) {
+                    memset_bulk(src, c, sizes[i]);
+                    t = now();
+                    cks[j]->f(p, src, sizes[i]);
+                } else {
+                    t = now();
+                    ks[j]->f(p, c, sizes[i]);
+                }
+                t = now() - t;
+                if (trial < 0)
+                    first = t;
+                else
+                    samples[trial] = t;
+                t = now();
+                at = verify_fill(p, c, sizes[i]);
+                verify += now() - t;
+                if (at < sizes[i]) {
+                    printf("%-20s %12zu MISMATCH at byte %zu: %#x, not %#x\n",
+                           name, sizes[i], at, p[at], c & 0xff);
+                    bad = 1;
+                }
+            }
+            munmap(p, sizes[i]);
+            if (copies)
+                munmap(src, sizes[i]);
+            if (bad)
+                return 1;
+            summarise(samples, trials, &s);
+            printf("%-20s %12zu %11.3f %10.3f [%9.3f, %9.3f] %11.3f\n",
+                   name, sizes[i], sizes[i] / first / 1e9,
+                   sizes[i] / s.median / 1e9, sizes[i] / s.hi / 1e9,
+                   sizes[i] / s.lo / 1e9,
+                   sizes[i] * (trials + 1.0) / verify / 1e9);
+            verify = 0;
+        }
+    }
+    free(samples);
+    return 0;
+}
+
+/* Benchmarks are selected by the first argument. Note that they need linking
+ * with -pthread and -lm.
+ */
+static const struct {
+    const char* name;
+    int (*main)(int argc, char** argv);
+    const char* usage;
+} modes[] = {
+    { "workloads", workloads_main,
+      "[-c cpu] [-n trials] [-w workload] [-k kernel]" },
+    { "icache", icache_main,
+      "[-c cpu] [-n trials] [-s sizes] [-f pad_functions] [-k kernel]" },
+    { "tracked", tracked_main,
+      "[-c cpu] [-n trials] [-s region_size] [-p touched_pages]" },
+    { "lazy", lazy_main,
+      "[-c cpu] [-n trials] [-s region_size] [-f touched_percents] "
+      "[-v value]" },
+    { "filezero", filezero_main,
+      "[-c cpu] [-n trials] [-s segment_size] [-d directory]..." },
+    { "durable", durable_main,
+      "[-c cpu] [-n trials] [-s journal_size] [-b block_sizes] "
+      "[-d directory]" },
+    { "large", large_main,
+      "[-c cpu] [-n trials] [-s sizes] [-k kernels] "
+      "[-H none|thp|hugetlb] [-C]" },
+    { "impl", impl_main, "[-s sizes]" },
+    { "run", run_main,
+      "[-C] -l | [-C] -k kernel [-s size] [-a align] [-i iterations]" },
+    { "bench", bench_main,
+      "[-c cpu] [-n trials] [-t min_trial_ms] [-v max_cv_percent] "
+      "[-s sizes] [-a aligns] [-k kernel] [-o save_as] [-b baseline] "
+      "[-T tolerance_percent] [-C]" },
+    { "interference", interference_main,
+      "[-r reader_cpu] [-w writer_cpu] [-s working_set] [-f fill_size] "
+      "[-t seconds] [-C]" },
+};
+
+/* Differential fuzzing: a fuzzer hands us arbitrary bytes, from which we
+ * derive a fill and run every implementation on it, comparing the result with
+ * libc's memset. The input is read as
+ *
+ *   bytes 0-2   the size, little endian, up to FUZZ_MAX_SIZE
+ *   bytes 3-4   the offset of the start from a page boundary
+ *   byte 5      bit 0 set to put the end of the fill near the guard page
+ *               rather than the start; bits 1-7 how near
+ *   bytes 6-9   the value, including any bits above the low byte
+ *   byte 10     flags for memset_ex
+ *   the rest    seeds the bytes around the fill
+ *
+ * with missing bytes taken as zero. The buffers have guard pages at each end,
+ * so strays crash, and the bytes around the fill are random, so a kernel that
+ * writes the right value in the wrong place is caught too. Any difference
+ * aborts, which is what fuzzers look for.
+ *
+ * Build with -DMEMSET_FUZZ and -fsanitize=fuzzer for libFuzzer. Adding
+ * -DMEMSET_FUZZ_STDIN gives a main that runs each file named on the command
+ * line, or stdin, through the same function, for AFL and for replaying
+ * crashes (see the fuzz targets in the Makefile).
+ */
+#ifdef MEMSET_FUZZ
+#define FUZZ_MAX_SIZE (1 << 20)
+
+struct fuzz_buffer {
+    byte* data;      /* FUZZ_MAX_SIZE + 2 pages, between guard pages. */
+    size_t len;
+};
+
+static int fuzz_buffer_init(struct fuzz_buffer* b) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    byte* map;
+
+    b->len = FUZZ_MAX_SIZE + 2 * page;
+    map = mmap(NULL, b->len + 2 * page, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED || mprotect(map, page, PROT_NONE) ||
+        mprotect(map + page + b->len, page, PROT_NONE))
+        return -1;
+    b->data = map + page;
+    return 0;
+}
+
+static uint64_t fuzz_bytes(const uint8_t* data, size_t size, size_t at,
+                           int n) {
+    uint64_t x = 0;
+    int i;
+
+    for (i = 0; i < n; ++i)
+        if (at + i < size)
+            x |= (uint64_t)data[at + i] << (8 * i);
+    return x;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    static struct fuzz_buffer want, got;
+    size_t n, offset, near, i, lo, hi;
+    const struct kernel* k;
+    unsigned flags;
+    uint64_t state, seed;
+    unsigned int j;
+    byte* p;
+    int c, end;
+
+    if (!want.data && (fuzz_buffer_init(&want) || fuzz_buffer_init(&got)))
+        abort();
+
+    n = fuzz_bytes(data, size, 0, 3) % (FUZZ_MAX_SIZE + 1);
+    offset = fuzz_bytes(data, size, 3, 2) % sysconf(_SC_PAGESIZE);
+    end = fuzz_bytes(data, size, 5, 1) & 1;
+    near = fuzz_bytes(data, size, 5, 1) >> 1;
+    c = (int)fuzz_bytes(data, size, 6, 4);
+    flags = fuzz_bytes(data, size, 10, 1);
+    seed = 0x9e3779b97f4a7c15ULL;
+    for (i = 11; i < size; ++i)
+        seed = mix64(seed ^ data[i]);
+
+    /* The fill goes at the same place in both buffers, with the same random
+     * bytes around it.
+     */
+    lo = end ? want.len - n - near : offset;
+    hi = lo + n;
+    lo = lo > GUARD_SLACK ? lo - GUARD_SLACK : 0;
+    hi = hi + GUARD_SLACK < want.len ? hi + GUARD_SLACK : want.len;
+    p = want.data + (end ? want.len - n - near : offset);
+    for (state = seed | 1, i = lo; i < hi; ++i)
+        want.data[i] = (byte)xorshift64(&state);
+    memset(p, c, n);
+
+    for (j = 0; j <= KERNELS; ++j) {
+        k = j < KERNELS ? &kernels[j] : NULL;
+        if (k && (!available(k) ||
+                  ((p - want.data) | n) & (k->granularity - 1)))
+            continue;
+        for (state = seed | 1, i = lo; i < hi; ++i)
+            got.data[i] = (byte)xorshift64(&state);
+        if (k)
+            k->f(got.data + (p - want.data), c, n);
+        else
+            memset_ex(got.data + (p - want.data), c, n, flags);
+        if (memcmp(want.data + lo, got.data + lo, hi - lo)) {
+            for (i = lo; want.data[i] == got.data[i]; ++i);
+            fprintf(stderr, "%s differs from memset with size %zu, offset "
+                    "%zu from the page and value %#x, on byte %ld\n",
+                    k ? k->name : "memset_ex", n,
+                    (size_t)(p - want.data) % sysconf(_SC_PAGESIZE), c,
+                    (long)(i - (p - want.data)));
+            abort();
+        }
+    }
+    return 0;
+}
+
+#ifdef MEMSET_FUZZ_STDIN
+static int fuzz_file(FILE* f) {
+    static uint8_t input[1 << 16];
+    size_t size = fread(input, 1, sizeof(input), f);
+
+    return ferror(f) ? -1 : LLVMFuzzerTestOneInput(input, size);
+}
+
+int main(int argc, char** argv) {
+    FILE* f;
+    int i;
+
+    if (argc < 2)
+        return fuzz_file(stdin) ? 1 : 0;
+    for (i = 1; i < argc; ++i) {
+        if (!(f = fopen(argv[i], "rb")) || fuzz_file(f)) {
+            perror(argv[i]);
+            return 1;
+        }
+        fclose(f);
+    }
+    return 0;
+}
+#endif
+#else
+
+/* When executed without arguments, this program will just validate the
+ * implementations in this file: every fill kernel at every size, offset and
+ * value that check_kernels tries (kernels that only take whole lines or pages
+ * are only given those), memset_ex with every combination of hints, then
+ * memcpy_pad, the copy kernels, resets of tracked and lazy regions and
+ * zero_mapped_file_range.
+ */
+int main(int argc, char** argv) {
+    unsigned int i;
+    int failed;
+
+    if (argc > 1) {
+        for (i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i)
+            if (!strcmp(argv[1], modes[i].name))
+                return modes[i].main(argc - 1, argv + 1);
+        fprintf(stderr, "usage: %s\n", argv[0]);
+        for (i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i)
+            fprintf(stderr, "       %s %s %s\n", argv[0], modes[i].name,
+                    modes[i].usage);
+        return 2;
+    }
+
+    failed = check_kernels() != 0;
+    failed |= check_memset_ex() != 0;
+    failed |= check_memcpy_pad() != 0;
+    for (i = 0; i < COPY_KERNELS; ++i)
+        if (!copy_kernels[i].available || copy_kernels[i].available())
+            failed |= check_copy(&copy_kernels[i]) != 0;
+    failed |= check_tracked_regions() != 0;
+    failed |= check_lazy_regions() != 0;
+    failed |= check_zero_mapped_file_range() != 0;
+    return failed;
+}
+#endif
@@ -0,0 +1,325 @@
+/* The implementations in memset.c that are meant to be called from other code,
+ * as opposed to being read and benchmarked.
+ *
+ * Most calls to memset are small, and for a small fill the cost of the call
+ * itself (and of any dispatching to a CPU-specific implementation) can easily
+ * outweigh the cost of setting the memory. fast_memset below is therefore split
+ * in two. Sizes up to 64 bytes are handled inline at the call site, using a few
+ * overlapping stores and no loops so the inlined code stays small. Anything
+ * larger goes to memset_bulk, an out-of-line function that picks the best
+ * implementation for this CPU.
+ */
+
+#ifndef MEMSET_H
+#define MEMSET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Set n bytes at s to c, for any n, using the best implementation available
+ * for this CPU.
+ */
+void* memset_bulk(void* s, int c, size_t n);
+
+/* Name of the implementation memset_bulk is using: avx2, sse2 or word, erms
+ * if it's using rep stosb for every size, or libc. memset_bulk_impl_for says
+ * which it uses for a fill of n bytes, which may also be erms or nt (for
+ * non-temporal stores).
+ */
+const char* memset_bulk_impl(void);
+const char* memset_bulk_impl_for(size_t n);
+
+/* How memset_bulk has been set up, on this processor and by the MEMSET_IMPL,
+ * MEMSET_ERMS_THRESHOLD and MEMSET_NT_THRESHOLD environment variables (see
+ * dispatch_init in memset.c). The same choices apply to memcpy_bulk and
+ * memmove_bulk below.
+ */
+struct memset_bulk_info {
+    const char* impl;         /* As memset_bulk_impl. */
+    size_t erms_threshold;    /* rep stosb from this size up; 0 for never. */
+    size_t nt_threshold;      /* Non-temporal stores from this size up; 0 for
+                                 never. */
+    int overridden;           /* Whether the environment changed anything. */
+    const char* tuning;       /* The core memset_bulk is tuned for, such as
+                                 skylake-sp or zen3, or generic. */
+};
+
+void memset_bulk_query(struct memset_bulk_info* info);
+
+/* As memcpy and memmove, using the same family of implementations as
+ * memset_bulk.
+ */
+void* memcpy_bulk(void* dst, const void* src, size_t n);
+void* memmove_bulk(void* dst, const void* src, size_t n);
+
+/* Fill nlines whole 64 byte cache lines at s, which must be 64 byte aligned,
+ * with c; and clear npages whole pages at s, which must be page aligned. These
+ * skip the alignment and size handling of memset_bulk.
+ */
+void memset_lines(void* s, size_t nlines, int c);
+void clear_pages(void* s, size_t npages);
+
+/* Hints for memset_ex about what the caller is going to do with the memory.
+ *
+ * MEMSET_NONTEMPORAL: the memory won't be read for a while, so bypass the
+ *   cache rather than evict other data to make room for it. Ignored when
+ *   non-temporal stores are turned off (see memset_bulk_query).
+ * MEMSET_WILL_READ_SOON: the memory is about to be used, so keep it in the
+ *   cache however large it is. Overrides MEMSET_NONTEMPORAL.
+ * MEMSET_PARALLEL_OK: large fills may be split across several threads.
+ * MEMSET_MAY_RELEASE_PAGES: the memory is private and anonymous (e.g. from
+ *   malloc or mmap(MAP_PRIVATE | MAP_ANONYMOUS)), so when zeroing, whole pages
+ *   may be returned to the kernel to be zeroed on next touch instead.
+ * MEMSET_SMALL_LIKELY: sizes are usually small, so don't spend any effort on
+ *   strategies that only pay off for large fills.
+ */
+#define MEMSET_NONTEMPORAL       0x01u
+#define MEMSET_WILL_READ_SOON    0x02u
+#define MEMSET_PARALLEL_OK       0x04u
+#define MEMSET_MAY_RELEASE_PAGES 0x08u
+#define MEMSET_SMALL_LIKELY      0x10u
+
+/* As memset_bulk, taking the hints above into account. */
+void* memset_ex(void* s, int c, size_t n, unsigned flags);
+
+/* Fill memory that other threads may be reading concurrently without a lock.
+ * Every naturally aligned 8 byte word in the range is written with a single
+ * relaxed atomic store, so readers using aligned 8 byte atomic loads never see
+ * a torn value. Ends with a release fence.
+ */
+void* atomic_fill(void* s, int c, size_t n);
+
+/* A region of memory that can be quickly reset to a fixed byte value, by
+ * resetting only the pages written since the last reset. This relies on the
+ * kernel's soft-dirty page tracking, which is process-wide; don't reset one
+ * tracked region while another thread is writing to a different one. Where
+ * soft-dirty tracking is unavailable, resets fill the whole region.
+ *
+ * tracked_region_create returns NULL on failure. tracked_region_reset returns
+ * the number of pages it reset.
+ */
+struct tracked_region;
+struct tracked_region* tracked_region_create(size_t size, int c);
+void* tracked_region_base(const struct tracked_region* r);
+long tracked_region_reset(struct tracked_region* r);
+void tracked_region_destroy(struct tracked_region* r);
+
+/* A region of memory whose reset to a byte value takes constant time. Pages
+ * are dropped on reset and refilled with the value when next accessed, by a
+ * userfaultfd handler thread. Without userfaultfd, resets to zero still drop
+ * pages but resets to other values fill the whole region immediately;
+ * lazy_region_is_lazy says which.
+ *
+ * lazy_region_create returns NULL on failure; lazy_region_reset returns 0 on
+ * success.
+ */
+struct lazy_region;
+struct lazy_region* lazy_region_create(size_t size, int c);
+void* lazy_region_base(const struct lazy_region* r);
+int lazy_region_is_lazy(const struct lazy_region* r);
+int lazy_region_reset(struct lazy_region* r, int c);
+void lazy_region_destroy(struct lazy_region* r);
+
+/* Zero n bytes at s. Where they lie in a shared file mapping, whole blocks
+ * are zeroed by the filesystem with fallocate rather than with stores, so they
+ * aren't dirtied and written back; the rest are zeroed with stores. Returns the
+ * number of bytes zeroed with fallocate. As with stores, the zeroes aren't
+ * durable until msync or fsync. The file is found by name, so a file that has
+ * since been unlinked is zeroed with stores.
+ */
+size_t zero_mapped_file_range(void* s, size_t n);
+
+/* Fill n bytes of a file mapping at s with c and msync them, all at once. The
+ * fill bypasses the cache unless non-temporal stores are turned off (see
+ * memset_bulk_query). With flush_lines, fill through the cache and write each
+ * line back as we go (for DAX mappings of persistent memory), where the
+ * processor can. Returns msync's result.
+ */
+int durable_fill(void* s, int c, size_t n, int flush_lines);
+
+/* As memset_bulk, but guaranteed not to be optimised away even if the memory is
+ * never read again. Use this for wiping secrets.
+ */
+void* secure_memset(void* s, int c, size_t n);
+
+/* Unaligned loads and stores of 4 and 8 bytes. GCC and Clang let us describe
+ * these directly as types. Elsewhere memcpy is the portable way to write them,
+ * and any reasonable compiler turns a fixed size memcpy into a single load or
+ * store.
+ */
+#ifdef __GNUC__
+typedef uint32_t __attribute__((may_alias, aligned(1))) memset_u32;
+typedef uint64_t __attribute__((may_alias, aligned(1))) memset_u64;
+#define MEMSET_STORE(type, p, x) (*(type*)(p) = (type)(x))
+#define MEMSET_LOAD(type, x, p) ((x) = *(const type*)(p))
+#else
+#define MEMSET_STORE(type, p, x) \
+    do { type _v = (type)(x); memcpy((p), &_v, sizeof(_v)); } while (0)
+#define MEMSET_LOAD(type, x, p) memcpy(&(x), (p), sizeof(x))
+typedef uint32_t memset_u32;
+typedef uint64_t memset_u64;
+#endif
+
+static inline void* fast_memset(void* s, int c, size_t n) {
+    unsigned char* p = (unsigned char*)s;
+    uint64_t x;
+
+    if (n > 64)
+        return memset_bulk(s, c, n);
+
+    /* For each size class, one store from the start and one ending exactly at
+     * the end cover the whole range, overlapping in the middle.
+     */
+    x = (uint64_t)(c & 0xff) * 0x0101010101010101ULL;
+    if (n >= 16) {
+        MEMSET_STORE(memset_u64, p, x);
+        MEMSET_STORE(memset_u64, p + 8, x);
+        MEMSET_STORE(memset_u64, p + n - 16, x);
+        MEMSET_STORE(memset_u64, p + n - 8, x);
+        if (n > 32) {
+            MEMSET_STORE(memset_u64, p + 16, x);
+            MEMSET_STORE(memset_u64, p + 24, x);
+            MEMSET_STORE(memset_u64, p + n - 32, x);
+            MEMSET_STORE(memset_u64, p + n - 24, x);
+        }
+    } else if (n >= 8) {
+        MEMSET_STORE(memset_u64, p, x);
+        MEMSET_STORE(memset_u64, p + n - 8, x);
+    } else if (n >= 4) {
+        MEMSET_STORE(memset_u32, p, x);
+        MEMSET_STORE(memset_u32, p + n - 4, x);
+    } else if (n) {
+        p[0] = (unsigned char)c;
+        p[n / 2] = (unsigned char)c;
+        p[n - 1] = (unsigned char)c;
+    }
+    return s;
+}
+
+/* Copies of up to 64 bytes work the same way as fast_memset, with a load for
+ * each store. Everything is loaded before anything is stored, so the ranges
+ * may overlap.
+ */
+static inline void memset_small_copy(unsigned char* d, const unsigned char* s,
+                                     size_t n) {
+    uint64_t a, b, x, y, a2, b2, x2, y2;
+    uint32_t e, f;
+
+    if (n >= 16) {
+        MEMSET_LOAD(memset_u64, a, s);
+        MEMSET_LOAD(memset_u64, b, s + 8);
+        MEMSET_LOAD(memset_u64, x, s + n - 16);
+        MEMSET_LOAD(memset_u64, y, s + n - 8);
+        if (n > 32) {
+            MEMSET_LOAD(memset_u64, a2, s + 16);
+            MEMSET_LOAD(memset_u64, b2, s + 24);
+            MEMSET_LOAD(memset_u64, x2, s + n - 32);
+            MEMSET_LOAD(memset_u64, y2, s + n - 24);
+            MEMSET_STORE(memset_u64, d + 16, a2);
+            MEMSET_STORE(memset_u64, d + 24, b2);
+            MEMSET_STORE(memset_u64, d + n - 32, x2);
+            MEMSET_STORE(memset_u64, d + n - 24, y2);
+        }
+        MEMSET_STORE(memset_u64, d, a);
+        MEMSET_STORE(memset_u64, d + 8, b);
+        MEMSET_STORE(memset_u64, d + n - 16, x);
+        MEMSET_STORE(memset_u64, d + n - 8, y);
+    } else if (n >= 8) {
+        MEMSET_LOAD(memset_u64, a, s);
+        MEMSET_LOAD(memset_u64, b, s + n - 8);
+        MEMSET_STORE(memset_u64, d, a);
+        MEMSET_STORE(memset_u64, d + n - 8, b);
+    } else if (n >= 4) {
+        MEMSET_LOAD(memset_u32, e, s);
+        MEMSET_LOAD(memset_u32, f, s + n - 4);
+        MEMSET_STORE(memset_u32, d, e);
+        MEMSET_STORE(memset_u32, d + n - 4, f);
+    } else if (n) {
+        unsigned char g = s[0], h = s[n / 2], i = s[n - 1];
+
+        d[0] = g;
+        d[n / 2] = h;
+        d[n - 1] = i;
+    }
+}
+
+static inline void* fast_memcpy(void* dst, const void* src, size_t n) {
+    if (n > 64)
+        return memcpy_bulk(dst, src, n);
+    memset_small_copy((unsigned char*)dst, (const unsigned char*)src, n);
+    return dst;
+}
+
+static inline void* fast_memmove(void* dst, const void* src, size_t n) {
+    if (n > 64)
+        return memmove_bulk(dst, src, n);
+    memset_small_copy((unsigned char*)dst, (const unsigned char*)src, n);
+    return dst;
+}
+
+/* Copy n bytes from src to dst and fill the rest of total bytes at dst with c,
+ * as memcpy(dst, src, n) then memset(dst + n, c, total - n) would, for padding
+ * fixed size records. n must be at most total, and src mustn't overlap the
+ * total bytes at dst.
+ *
+ * Doing the two together lets them share the overlapping stores at their
+ * boundary. We fill the padding first, and if it's shorter than a word we do
+ * it with one word store ending at total, which spills back over the start of
+ * the data. The copy then writes over the spill.
+ */
+static inline void* memcpy_pad(void* dst, const void* src, size_t n,
+                               size_t total, int c) {
+    unsigned char* d = (unsigned char*)dst;
+
+    if (total >= 8 && total - n < 8)
+        MEMSET_STORE(memset_u64, d + total - 8,
+                     (uint64_t)(c & 0xff) * 0x0101010101010101ULL);
+    else
+        fast_memset(d + n, c, total - n);
+    fast_memcpy(d, src, n);
+    return dst;
+}
+
+#ifdef __cplusplus
+}
+
+#include <type_traits>
+
+/* Holds a value and wipes it with secure_memset when it goes out of scope,
+ * however that happens. Only for types whose contents live entirely within the
+ * object; wiping a std::vector this way would leave its elements behind.
+ *
+ *     ScopedWipe<std::array<uint8_t, 32>> key;
+ *     derive_key(key->data());
+ */
+template <typename T>
+class ScopedWipe {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "ScopedWipe can only wipe trivially copyable types");
+
+  public:
+    ScopedWipe() : value_() {}
+    explicit ScopedWipe(const T& value) : value_(value) {}
+    ~ScopedWipe() { secure_memset(&value_, 0, sizeof(value_)); }
+
+    ScopedWipe(const ScopedWipe&) = delete;
+    ScopedWipe& operator=(const ScopedWipe&) = delete;
+
+    T& get() { return value_; }
+    const T& get() const { return value_; }
+    T& operator*() { return value_; }
+    const T& operator*() const { return value_; }
+    T* operator->() { return &value_; }
+    const T* operator->() const { return &value_; }
+
+  private:
+    T value_;
+};
+#endif
+
+#endif